@@ -4,8 +4,31 @@
 #include <atomic>
 #include <thread>
 #include <vector>
+#include <deque>
+#include <chrono>
+#include <cstdint>
+#include <cerrno>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+#include <fstream>
+
+#if defined(__linux__)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
 
 constexpr size_t MAX_JOBS{64}; // Job systems must fail loudly if job storage overflows. Silent overflow is instant UB
+static_assert((MAX_JOBS & (MAX_JOBS - 1)) == 0, "JobQueue indices are masked, MAX_JOBS must be a power of two");
 
 struct Arena
 {
@@ -25,9 +48,11 @@ struct Arena
 
     void* allocate(size_t size, size_t alignment = alignof(std::max_align_t))
     {
-        size_t aligned_offset = roundup(offset, alignment);
+        //Align the address, not the offset: operator new only guarantees max_align_t, and alignas(64) types need more
+        uintptr_t base = reinterpret_cast<uintptr_t>(memory);
+        size_t aligned_offset = roundup(base + offset, alignment) - base;
 
-        if (aligned_offset + size > capacity)
+        if (aligned_offset > capacity || size > capacity - aligned_offset)
             return nullptr;
 
         void* ptr = static_cast<char*>(memory) + aligned_offset;
@@ -62,28 +87,100 @@ T* arena_allocate(struct Arena& arena, Args&&... args)
         return nullptr;
     return new (mem) T(std::forward<Args>(args)...);
 }
+//Value-initializes `count` objects, so atomics and PODs start zeroed
+template <typename T>
+T* arena_allocate_array(struct Arena& arena, size_t count)
+{
+    void* mem = arena.allocate(sizeof(T) * count, alignof(T));
+    if (!mem)
+        return nullptr;
+    T* first = static_cast<T*>(mem);
+    for (size_t i = 0; i < count; ++i)
+        new (first + i) T();
+    return first;
+}
 template <typename T>
 void arena_destroy(T* obj)
 {
     if (obj)
         obj->~T();
 }
+//Striped counter: every worker counts spawned and finished jobs in its own shard, so fan-out never
+//serializes on one cache line. Shard 0 is shared by threads that aren't workers (main, blocking pool, timers).
+//Nobody can tell locally that they retired the last job, so idle workers run the lazy zero check
+//(counter_is_zero) every TERMINATION_SCAN_SWEEPS failed sweeps and publish the result in `done`.
+//`done` lives on its own line and is written exactly once, so idle workers can poll it for free.
+constexpr size_t JOB_COUNTER_SHARDS{16};
+constexpr size_t TERMINATION_SCAN_SWEEPS{64}; //Power of two
+
+struct alignas(64) CounterShard
+{
+    std::atomic<int64_t> spawned;  //Both only ever grow
+    std::atomic<int64_t> finished;
+};
+
 struct JobCounter {
-    std::atomic<int> remaining;
-    JobCounter() : remaining(0) {}
+    CounterShard shards[JOB_COUNTER_SHARDS];
+    alignas(64) std::atomic<bool> done;
+    JobCounter() : shards{}, done(false) {}
 };
 struct JobContext;
 //Job Structure 
 struct Job
 {
-    void (*fn)(void*);
+    void (*fn)(void* data, JobContext* ctx); //ctx is the context of the worker running the job, which may have stolen it
     void* data;
     JobCounter* counter;
-    JobContext* ctx;
+    JobContext* ctx; //Context of the creator, only handed to fn when the job runs off-worker (e.g. blocking pool)
 
     bool is_leaf;
+    bool latency_critical {false}; //Efficiency-core workers leave it for performance cores to steal
+};
+
+//Build with -DJOB_QUEUE_SOA to keep the ring as parallel arrays: dispatch and batch peeking then only
+//touch the dense fn/data arrays instead of pulling whole 40-byte Jobs through the cache.
+#if defined(JOB_QUEUE_SOA)
+struct JobQueue //Owner Thread pushes & pops from tail. Stealers pop from head
+{
+    void (*fns[MAX_JOBS])(void* data, JobContext* ctx);
+    void* datas[MAX_JOBS];
+    JobCounter* counters[MAX_JOBS];
+    JobContext* ctxs[MAX_JOBS];
+    bool leaves[MAX_JOBS];
+    bool criticals[MAX_JOBS];
+    std::atomic<size_t> head;
+    std::atomic<size_t> tail;
 };
 
+Job queue_read(const JobQueue& q, size_t index)
+{
+    size_t i {index & (MAX_JOBS - 1)};
+    return Job{q.fns[i], q.datas[i], q.counters[i], q.ctxs[i], q.leaves[i], q.criticals[i]};
+}
+
+void queue_write(JobQueue& q, size_t index, const Job& job)
+{
+    size_t i {index & (MAX_JOBS - 1)};
+    q.fns[i] = job.fn;
+    q.datas[i] = job.data;
+    q.counters[i] = job.counter;
+    q.ctxs[i] = job.ctx;
+    q.leaves[i] = job.is_leaf;
+    q.criticals[i] = job.latency_critical;
+}
+
+void* queue_peek_data(const JobQueue& q, size_t index)
+{
+    return q.datas[index & (MAX_JOBS - 1)];
+}
+
+//Owner-only: whether the slot at index holds a job that can share a batch with `job`
+bool queue_matches(const JobQueue& q, size_t index, const Job& job)
+{
+    size_t i {index & (MAX_JOBS - 1)};
+    return q.fns[i] == job.fn && q.counters[i] == job.counter && q.leaves[i] == job.is_leaf;
+}
+#else
 struct JobQueue //Owner Thread pushes & pops from tail. Stealers pop from head
 {
     Job jobs[MAX_JOBS];
@@ -91,19 +188,110 @@ struct JobQueue //Owner Thread pushes & pops from tail. Stealers pop from head
     std::atomic<size_t> tail;
 };
 
+Job queue_read(const JobQueue& q, size_t index)
+{
+    return q.jobs[index & (MAX_JOBS - 1)];
+}
+
+void queue_write(JobQueue& q, size_t index, const Job& job)
+{
+    q.jobs[index & (MAX_JOBS - 1)] = job;
+}
+
+void* queue_peek_data(const JobQueue& q, size_t index)
+{
+    return q.jobs[index & (MAX_JOBS - 1)].data;
+}
+
+bool queue_matches(const JobQueue& q, size_t index, const Job& job)
+{
+    const Job& other {q.jobs[index & (MAX_JOBS - 1)]};
+    return other.fn == job.fn && other.counter == job.counter && other.is_leaf == job.is_leaf;
+}
+#endif
+
+struct MailItem //Caller-owned, like TimerEntry
+{
+    Job job;
+    MailItem* next;
+};
+
+constexpr uint32_t CPU_CAPACITY_SCALE{1024}; //Kernel's capacity scale: the fastest core type is 1024
+
 struct Worker
 {
     JobQueue queue;
     size_t id;
+    uint32_t capacity {CPU_CAPACITY_SCALE}; //Relative speed of the core the worker is pinned to
+    bool efficiency {false};                //Pinned to an efficiency core, see job_system_place_workers
 
-    
+    std::atomic<MailItem*> mailbox; //Jobs posted by other threads, see post_job
+    MailItem* mail_backlog;         //Owner-only: drained mail that didn't fit in the ring yet
 };
 
+struct TimerWheel;
+struct IoRing;
+struct BlockingPool;
+struct WorkerGroupRegistry;
+struct JobSystem;
+
 struct JobContext{
     Arena* arena;
     Worker* worker;
+    TimerWheel* timers;
+    IoRing* io;
+    BlockingPool* blocking;
+    size_t worker_count;
+    Worker* workers; //All workers, indexed by Worker::id
+    WorkerGroupRegistry* groups {nullptr}; //Worker groups idle workers may join, see worker_group_run
+    JobSystem* system {nullptr};           //Owning pool, workers above its allowed share park
+};
+
+//---- Spawning ----
+enum class SpawnPolicy
+{
+    help_first, //Publish every child and return, the worker pops one straight back
+    work_first  //Run the first child inline and publish only the rest: one push and one pop fewer per split
 };
 
+CounterShard& counter_shard(JobCounter& counter, JobContext* ctx)
+{
+    if (!ctx || !ctx->worker)
+    {
+        return counter.shards[0];
+    }
+    return counter.shards[1 + ctx->worker->id % (JOB_COUNTER_SHARDS - 1)];
+}
+
+//Counts future work. Like before, this must happen BEFORE the job is published
+void counter_add(JobCounter& counter, JobContext* ctx, int64_t count)
+{
+    counter_shard(counter, ctx).spawned.fetch_add(count, std::memory_order_relaxed);
+}
+
+void counter_retire(JobCounter& counter, JobContext* ctx, int64_t count = 1)
+{
+    counter_shard(counter, ctx).finished.fetch_add(count, std::memory_order_release);
+}
+
+//Sums every `finished` first, then every `spawned`. A job is always counted before it can finish, so
+//finished_seen <= finished(t) <= spawned(t) <= spawned_seen for any moment t between the two passes:
+//equal sums mean nothing was outstanding at t, and with nothing running nothing can be spawned again.
+bool counter_is_zero(JobCounter& counter)
+{
+    int64_t finished {0};
+    for (CounterShard& shard : counter.shards)
+    {
+        finished += shard.finished.load(std::memory_order_acquire);
+    }
+    int64_t spawned {0};
+    for (CounterShard& shard : counter.shards)
+    {
+        spawned += shard.spawned.load(std::memory_order_acquire);
+    }
+    return spawned == finished;
+}
+
 struct SumJobData {
     int* array;
     size_t count;
@@ -121,6 +309,7 @@ struct SumRangeJobData{
 
     JobContext* ctx;
     JobCounter* counter;
+    SpawnPolicy policy;
     SumRangeJobData(
         int* array,
         size_t begin,
@@ -128,19 +317,61 @@ struct SumRangeJobData{
         std::atomic<int>* result,
 
         JobContext* ctx,
-        JobCounter* counter
+        JobCounter* counter,
+        SpawnPolicy policy = SpawnPolicy::work_first
     )
     : array(array),
       begin(begin),
       end(end),
       result(result),
       ctx(ctx),
-      counter(counter)
+      counter(counter),
+      policy(policy)
       {}
 };
 void push_job(Worker& worker, Job job);
+
+//Slots left below the half-full mark. Anything releasing work into a ring from outside the job tree (mail,
+//timers, I/O, blocking continuations) and every parallel_for split stays below it, so the worker's
+//remaining spawns never overflow the ring; the rest waits for the next poll or runs inline
+size_t ring_room(const Worker& worker)
+{
+    size_t t {worker.queue.tail.load(std::memory_order_relaxed)};
+    size_t h {worker.queue.head.load(std::memory_order_relaxed)};
+    return t - h < MAX_JOBS / 2 ? MAX_JOBS / 2 - (t - h) : 0;
+}
+
+bool ring_has_room(const Worker& worker)
+{
+    return ring_room(worker) > 0;
+}
+
+//Counts and publishes `count` children on the calling worker's queue, in order.
+//Under work_first children[0] is not published or counted at all: it runs right here before spawn returns.
+void spawn(JobContext& ctx, Job* children, size_t count, SpawnPolicy policy)
+{
+    size_t first_published {policy == SpawnPolicy::work_first ? size_t{1} : size_t{0}};
+
+    //Increment the counter BEFORE publishing
+    for (size_t i = first_published; i < count; ++i)
+    {
+        if (children[i].is_leaf && children[i].counter)
+        {
+            counter_add(*children[i].counter, &ctx, 1);
+        }
+    }
+    for (size_t i = first_published; i < count; ++i)
+    {
+        push_job(*ctx.worker, children[i]);
+    }
+
+    if (first_published == 1 && count > 0)
+    {
+        children[0].fn(children[0].data, &ctx);
+    }
+}
 //Sum job
-void sum_job(void* ptr)
+void sum_job(void* ptr, JobContext* ctx)
 {
     auto* data {static_cast<SumRangeJobData*>(ptr)};
     constexpr size_t Threshold {64};
@@ -156,183 +387,3488 @@ void sum_job(void* ptr)
         return;
     }
     //Split into two child jobs
-    size_t mid {((data->begin + count)/2)};
+    size_t mid {data->begin + count/2};
 
-    SumRangeJobData* left = arena_allocate<SumRangeJobData>(*data->ctx->arena,data->array,data->begin,mid,data->result,data->ctx,data->counter);
-    SumRangeJobData* right = arena_allocate<SumRangeJobData>(*data->ctx->arena,data->array,mid,data->end,data->result,data->ctx,data->counter);
-
-    //Increment the counter BEFORE publishing
-    Worker* self {data->ctx->worker};
-    data->counter->remaining.fetch_add(2, std::memory_order_relaxed);
-    push_job(*self, Job{sum_job, left, data->counter, data->ctx, false});
-    push_job(*self, Job{sum_job, right, data->counter, data->ctx, false});
+    SumRangeJobData* left = arena_allocate<SumRangeJobData>(*ctx->arena,data->array,data->begin,mid,data->result,ctx,data->counter,data->policy);
+    SumRangeJobData* right = arena_allocate<SumRangeJobData>(*ctx->arena,data->array,mid,data->end,data->result,ctx,data->counter,data->policy);
+    if(!left || !right)
+    {
+        //Arena exhausted: finish this range serially rather than dropping it
+        int local = 0;
+        for(size_t i = data->begin;i < data->end; ++i)
+        {
+            local += data->array[i];
+        }
+        data->result->fetch_add(local,std::memory_order_relaxed);
+        return;
+    }
 
+    //Children go on the queue of the worker running us, not the one that created us
+    Job children[2] {
+        Job{sum_job, left, data->counter, ctx, true},
+        Job{sum_job, right, data->counter, ctx, true}
+    };
+    spawn(*ctx, children, 2, data->policy);
 }
-void execute_job(Job& job)
+void execute_job(Job& job, JobContext* ctx)
 {
-    job.fn(job.data);
+    job.fn(job.data, ctx ? ctx : job.ctx);
     if (job.is_leaf&&job.counter)
     {
-        job.counter->remaining.fetch_sub(1, std::memory_order_release);
+        counter_retire(*job.counter, ctx);
     }
 }
 
-bool pop_local(JobQueue& q, Job& out)
+//---- Parallel for ----
+//Runs fn over [begin, end) with the decomposition chosen by a Partitioner, so each loop shape can pick
+//the split that costs the fewest spawns.
+using RangeFn = void (*)(size_t begin, size_t end, void* user);
+
+enum class PartitionKind
 {
-    size_t t = q.tail.load(std::memory_order_relaxed);
-    if(t == q.head.load(std::memory_order_acquire))
-    {
-        return false;
-    }
+    binary,         //Halve until a range is at most `grain`
+    k_ary,          //Split into `arity` parts per level until at most `grain`: fewer levels, fewer spawn calls
+    static_chunked, //Cut once into `arity` equal chunks (0 = one per worker) that are never split again
+    guided          //Peel chunks of remaining / (2 * workers), shrinking towards `grain`, remainder stays stealable
+};
 
-    t--;
-    q.tail.store(t,std::memory_order_relaxed);
-    out = q.jobs[t];
-    return true;
-}
+constexpr size_t MAX_SPLIT_ARITY{16}; //Bounds per-split fan-out, splits also stop at the ring's half mark (ring_room)
 
-bool steal(JobQueue& victim, Job& out)
+struct Partitioner
 {
-    size_t h = victim.head.load(std::memory_order_acquire);
-    size_t t = victim.tail.load(std::memory_order_acquire);
-    
-    if(h>=t)
+    PartitionKind kind {PartitionKind::binary};
+    size_t grain {64};
+    size_t arity {4};
+    SpawnPolicy policy {SpawnPolicy::work_first};
+};
+
+struct ParallelForJobData
+{
+    RangeFn fn;
+    void* user;
+    size_t begin;
+    size_t end;
+    Partitioner part;
+    JobCounter* counter;
+    size_t chunks; //static_chunked: equal chunks this range is still to be cut into, 0 = not decided yet (root)
+};
+
+void parallel_for_job(void* ptr, JobContext* ctx);
+
+//Splits [data->begin, data->end) into up to `parts` near-equal children and spawns them. Nested splits
+//add up on the ring, so each one publishes only what fits below the half mark. With chunks != 0 children
+//are cut on chunk boundaries and carry their share of the chunks. False when the arena ran dry or there
+//was no room for a second child: the caller runs the range itself.
+bool parallel_for_split(ParallelForJobData* data, JobContext* ctx, size_t parts, size_t chunks = 0)
+{
+    size_t count {data->end - data->begin};
+    size_t runs_inline {data->part.policy == SpawnPolicy::work_first ? size_t{1} : size_t{0}};
+    parts = std::min({parts, count, MAX_SPLIT_ARITY, ring_room(*ctx->worker) + runs_inline});
+    if (parts < 2)
     {
         return false;
     }
-    if(!victim.head.compare_exchange_strong(
-        h,h+1,
-        std::memory_order_acq_rel
-    ))
+    size_t units {chunks ? chunks : parts};
+
+    Job children[MAX_SPLIT_ARITY];
+    ParallelForJobData* payloads {arena_allocate_array<ParallelForJobData>(*ctx->arena, parts)};
+    if (!payloads)
     {
         return false;
     }
 
-    out = victim.jobs[h];
+    size_t begin {data->begin};
+    size_t unit {0};
+    for (size_t i = 0; i < parts; ++i)
+    {
+        size_t next_unit {units * (i + 1) / parts};
+        size_t end {data->begin + count * next_unit / units};
+        payloads[i] = ParallelForJobData{data->fn, data->user, begin, end, data->part, data->counter, chunks ? next_unit - unit : 0};
+        children[i] = Job{parallel_for_job, &payloads[i], data->counter, ctx, true};
+        begin = end;
+        unit = next_unit;
+    }
+    spawn(*ctx, children, parts, data->part.policy);
     return true;
 }
 
-//Thread function
-void worker_thread(
-    Worker* self,
-    Worker* all_workers,
-    size_t worker_count,
-    JobCounter* counter
-)
+void parallel_for_job(void* ptr, JobContext* ctx)
 {
-    Job job;
-    while(true)
+    auto* data {static_cast<ParallelForJobData*>(ptr)};
+    const Partitioner& part {data->part};
+    size_t count {data->end - data->begin};
+    size_t workers {std::max<size_t>(ctx->worker_count, 1)};
+
+    bool split {false};
+    switch (part.kind)
+    {
+    case PartitionKind::binary:
+        split = count > part.grain && parallel_for_split(data, ctx, 2);
+        break;
+    case PartitionKind::k_ary:
+        split = count > part.grain && parallel_for_split(data, ctx, std::max<size_t>(part.arity, 2));
+        break;
+    case PartitionKind::static_chunked:
+    {
+        //Chunks are never split again, but a range holding several of them is: one split can publish
+        //at most MAX_SPLIT_ARITY children, so wide chunk counts are dealt out over a few levels
+        size_t chunks {std::min(data->chunks ? data->chunks : (part.arity ? part.arity : workers), count)};
+        split = chunks > 1 && parallel_for_split(data, ctx, chunks, chunks);
+        break;
+    }
+    case PartitionKind::guided:
     {
-        //1. Trying local work
-        if(pop_local(self->queue,job))
+        size_t chunk {std::max(part.grain, count / (2 * workers))};
+        if (chunk >= count)
         {
-            execute_job(job);
-            continue;
+            break;
         }
-        
-        //2.Trying to steal work from other Jobs
-        bool stolen{false};
-        for(size_t i = 0; i < worker_count; ++i)
-        {
-            if(i == self->id)
-            {continue;}
-
-            if(steal(all_workers[i].queue, job))
+        //Publish the remainder first so it can be stolen while we run the peeled chunk
+        auto* rest {arena_allocate<ParallelForJobData>(*ctx->arena, *data)};
+        if (!rest)
         {
-            execute_job(job);
-            stolen = true;
             break;
         }
+        rest->begin = data->begin + chunk;
+        Job remainder {parallel_for_job, rest, data->counter, ctx, true};
+        spawn(*ctx, &remainder, 1, SpawnPolicy::help_first);
+        data->fn(data->begin, data->begin + chunk, data->user);
+        split = true;
+        break;
+    }
+    }
 
-        }
-
-        if(stolen)
-        {
-            continue;
-        }
+    if (!split)
+    {
+        data->fn(data->begin, data->end, data->user);
+    }
+}
 
-        //When no work is found anywhere
-        if(counter->remaining.load(std::memory_order_acquire)==0)
-        {
-            break;
-        }
+//Publishes the root of a parallel loop on the calling worker. Payloads come from the running workers' arenas.
+bool parallel_for(JobContext& ctx, size_t begin, size_t end, RangeFn fn, void* user, JobCounter* counter, Partitioner part = {})
+{
+    if (begin >= end)
+    {
+        return true;
+    }
+    auto* root {arena_allocate<ParallelForJobData>(*ctx.arena, ParallelForJobData{fn, user, begin, end, part, counter, 0})};
+    if (!root)
+    {
+        return false;
     }
+    Job job {parallel_for_job, root, counter, &ctx, true};
+    spawn(ctx, &job, 1, SpawnPolicy::help_first);
+    return true;
 }
 
-void push_job(Worker& w, Job job)
+//---- Mailboxes ----
+//Only the owner may push onto its JobQueue, so other threads hand a worker jobs through its mailbox.
+//The owner drains it while idle and moves the jobs into its ring, where they can still be stolen.
+void post_job(Worker& target, MailItem* item, Job job)
 {
-    size_t t {w.queue.tail.load(std::memory_order_relaxed)};
-    w.queue.jobs[t] = job;
-    w.queue.tail.store(t+1, std::memory_order_relaxed);
+    item->job = job;
+    MailItem* head {target.mailbox.load(std::memory_order_relaxed)};
+    do
+    {
+        item->next = head;
+    } while (!target.mailbox.compare_exchange_weak(head, item, std::memory_order_release, std::memory_order_relaxed));
 }
 
-int main()
+//Keeps the ring at most half full, the rest waits in the backlog
+size_t poll_mailbox(Worker& worker)
 {
-    const unsigned int worker_count {std::thread::hardware_concurrency() > 1? std::thread::hardware_concurrency() - 1:1};//getting the hint towards the available number of threads
-    std::vector<std::thread> threads;//Created a dynamic array to store threads
-    std::vector<Worker> workers(worker_count);
-    JobCounter counter;
-    counter.remaining.store(0, std::memory_order_relaxed);  // ✅ start at 0
+    if (!worker.mail_backlog && worker.mailbox.load(std::memory_order_relaxed))
+    {
+        //Mailbox is LIFO, reverse it so jobs are queued in posting order
+        MailItem* item {worker.mailbox.exchange(nullptr, std::memory_order_acquire)};
+        while (item)
+        {
+            MailItem* next {item->next};
+            item->next = worker.mail_backlog;
+            worker.mail_backlog = item;
+            item = next;
+        }
+    }
 
-    for(size_t i =0; i<worker_count;++i)
+    size_t moved {0};
+    while (worker.mail_backlog && ring_has_room(worker))
     {
-        workers[i].id = i;
-        workers[i].queue.head.store(0);
-        workers[i].queue.tail.store(0);
+        MailItem* item {worker.mail_backlog};
+        worker.mail_backlog = item->next;
+        push_job(worker, item->job);
+        ++moved;
     }
+    return moved;
+}
 
-    Arena frameArena(1024);
-    
-    std::vector<JobContext> contexts(worker_count);
+//---- Affinity partitioning ----
+//Iterative code runs the same loop over the same data every frame. The affinity partitioner remembers
+//which worker ran each chunk and posts the chunk straight back to that worker next time, so it finds its data
+//still in cache. Stolen chunks simply move their affinity to the thief.
+struct AffinityPartitioner //Outlives frames, so it is not arena-allocated
+{
+    std::vector<size_t> owner; //Worker that last ran each chunk
 
-    for(size_t i =0; i<worker_count;++i)
+    explicit AffinityPartitioner(size_t chunks)
+        : owner(chunks, SIZE_MAX)
+    {}
+};
+
+struct AffinityChunkJobData
+{
+    RangeFn fn;
+    void* user;
+    size_t begin;
+    size_t end;
+    size_t* owner;
+    MailItem mail;
+};
+
+void affinity_chunk_job(void* ptr, JobContext* ctx)
+{
+    auto* data {static_cast<AffinityChunkJobData*>(ptr)};
+    *data->owner = ctx->worker->id; //Read next frame, after the counter hit zero
+    data->fn(data->begin, data->end, data->user);
+}
+
+//Splits [begin, end) into the partitioner's fixed chunk count and posts every chunk to its recorded worker.
+//Chunks without history are dealt out in contiguous blocks, one block per worker.
+bool parallel_for_affinity(JobContext& ctx, size_t begin, size_t end, RangeFn fn, void* user, JobCounter* counter, AffinityPartitioner& aff)
+{
+    size_t chunks {std::min(aff.owner.size(), end > begin ? end - begin : 0)};
+    if (chunks == 0)
     {
-        contexts[i] =  JobContext{&frameArena, &workers[i]};
+        return true;
+    }
+    AffinityChunkJobData* payloads {arena_allocate_array<AffinityChunkJobData>(*ctx.arena, chunks)};
+    if (!payloads)
+    {
+        return false;
     }
 
-    int a[] = {1,2,3};
-    int b[] = {4,5,6};
-    std::atomic<int> out1{0};
-    std::atomic<int> out2{0};
+    size_t workers {std::max<size_t>(ctx.worker_count, 1)};
+    counter_add(*counter, &ctx, static_cast<int64_t>(chunks));
+    for (size_t i = 0; i < chunks; ++i)
+    {
+        AffinityChunkJobData& data {payloads[i]};
+        data.fn = fn;
+        data.user = user;
+        data.begin = begin + (end - begin) * i / chunks;
+        data.end = begin + (end - begin) * (i + 1) / chunks;
+        data.owner = &aff.owner[i];
+
+        size_t target {aff.owner[i] < workers ? aff.owner[i] : i * workers / chunks};
+        Job job {affinity_chunk_job, &data, counter, &ctx, true};
+        if (!ctx.workers || target == ctx.worker->id)
+        {
+            post_job(*ctx.worker, &data.mail, job); //Still through the mailbox: the ring may not hold every chunk
+        }
+        else
+        {
+            post_job(ctx.workers[target], &data.mail, job);
+        }
+    }
+    return true;
+}
 
-    auto* p1 = arena_allocate<SumRangeJobData>(frameArena, a, 0 , 3, &out1, &contexts[0], &counter);
-    auto* p2 = arena_allocate<SumRangeJobData>(frameArena, b, 0 , 3, &out2, &contexts[0], &counter);
+//---- Static scheduling ----
+//For uniform loops one contiguous block per worker is all the decomposition needed. Each worker walks its
+//block in `grain` pieces claimed from a per-block cursor, which stays uncontended on a cache line of its own.
+//Only a worker that finishes early touches other blocks' cursors, taking pieces off the stragglers.
+struct alignas(64) StaticBlock
+{
+    std::atomic<size_t> next;
+    size_t end;
+};
 
+struct StaticLoop
+{
+    RangeFn fn;
+    void* user;
+    size_t grain;
+    StaticBlock* blocks;
+    size_t block_count;
+};
 
+struct StaticBlockJobData
+{
+    StaticLoop* loop;
+    size_t block;
+    MailItem mail;
+};
 
+void static_drain_block(StaticLoop& loop, StaticBlock& block)
+{
+    size_t begin;
+    while ((begin = block.next.fetch_add(loop.grain, std::memory_order_relaxed)) < block.end)
+    {
+        loop.fn(begin, std::min(begin + loop.grain, block.end), loop.user);
+    }
+}
 
-    // Initial jobs = future work → increment counter
-    counter.remaining.fetch_add(2, std::memory_order_relaxed);
+void static_block_job(void* ptr, JobContext*)
+{
+    auto* data {static_cast<StaticBlockJobData*>(ptr)};
+    StaticLoop& loop {*data->loop};
+    static_drain_block(loop, loop.blocks[data->block]);
 
-    // Pushing the initial jobs
-    push_job(workers[0], Job{sum_job, p1, &counter, &contexts[0], true});
-    push_job(workers[0], Job{sum_job, p2, &counter, &contexts[0], true});
-    //---- Launching worker threads ----
-    for(unsigned int i =0; i<worker_count; ++i)
+    //Own block done: help whoever is still behind, nearest neighbour first
+    for (size_t i = 1; i < loop.block_count; ++i)
     {
-        threads.emplace_back(
-            worker_thread,
-            &workers[i],
-            workers.data(),
-            worker_count,
-            &counter
-        );
+        static_drain_block(loop, loop.blocks[(data->block + i) % loop.block_count]);
     }
+}
 
+//Cuts [begin, end) into one block per worker and posts block i straight to worker i.
+//grain == 0 picks 1/16th of a block, enough pieces to rebalance without a claim per element.
+bool parallel_for_static(JobContext& ctx, size_t begin, size_t end, RangeFn fn, void* user, JobCounter* counter, size_t grain = 0)
+{
+    if (begin >= end)
+    {
+        return true;
+    }
+    size_t workers {ctx.workers ? std::max<size_t>(ctx.worker_count, 1) : 1};
+    size_t blocks {std::min(workers, end - begin)};
 
-    worker_thread(&workers[0], workers.data(),worker_count, &counter);//Main thread also works as a worker
+    StaticLoop* loop {arena_allocate<StaticLoop>(*ctx.arena)};
+    StaticBlock* ranges {arena_allocate_array<StaticBlock>(*ctx.arena, blocks)};
+    StaticBlockJobData* payloads {arena_allocate_array<StaticBlockJobData>(*ctx.arena, blocks)};
+    if (!loop || !ranges || !payloads)
+    {
+        return false;
+    }
 
+    //Blocks are sized by the capacity of the worker they're posted to, so on hybrid CPUs the
+    //efficiency cores don't leave the performance cores waiting at the end
+    size_t count {end - begin};
+    uint64_t total_capacity {0};
+    for (size_t i = 0; i < blocks; ++i)
+    {
+        total_capacity += ctx.workers && blocks == workers ? ctx.workers[i].capacity : 1;
+    }
+    *loop = StaticLoop{fn, user, grain ? grain : std::max<size_t>(count / blocks / 16, 1), ranges, blocks};
+    uint64_t prefix {0};
+    size_t block_begin {begin};
+    for (size_t i = 0; i < blocks; ++i)
+    {
+        prefix += ctx.workers && blocks == workers ? ctx.workers[i].capacity : 1;
+        size_t block_end {begin + static_cast<size_t>(static_cast<long double>(count) * prefix / total_capacity)};
+        ranges[i].next.store(block_begin, std::memory_order_relaxed);
+        ranges[i].end = i + 1 == blocks ? end : block_end;
+        block_begin = ranges[i].end;
+    }
 
-    //wait for all worker
-    for (auto& t :threads)
+    counter_add(*counter, &ctx, static_cast<int64_t>(blocks));
+    for (size_t i = 0; i < blocks; ++i)
     {
-        t.join();
+        payloads[i].loop = loop;
+        payloads[i].block = i;
+        Job job {static_block_job, &payloads[i], counter, &ctx, true};
+        if (ctx.workers && i != ctx.worker->id)
+        {
+            post_job(ctx.workers[i], &payloads[i].mail, job);
+        }
+        else
+        {
+            push_job(*ctx.worker, job);
+        }
     }
+    return true;
+}
 
-    // ✅ completion check
-    if ((counter.remaining.load(std::memory_order_acquire)) == 0)
+//---- Concurrent hash map ----
+//Insert-only open addressing with linear probing, sized once from the arena, for join-style workloads:
+//one parallel build phase, then one parallel probe phase once the build's counter has drained.
+//Duplicate keys get a slot each, like a multimap, since join build sides often repeat keys.
+constexpr uint64_t HASH_EMPTY_KEY{~uint64_t{0}}; //Reserved, can't be inserted
+
+struct HashSlot
+{
+    std::atomic<uint64_t> key;
+    uint64_t value; //Written right after the key is claimed, read only in the probe phase
+};
+
+struct ConcurrentHashMap
+{
+    HashSlot* slots;
+    size_t mask;
+
+    ConcurrentHashMap(const ConcurrentHashMap&) = delete;
+    ConcurrentHashMap& operator=(const ConcurrentHashMap&) = delete;
+
+    //At least twice `expected` slots, rounded to a power of two, keeps probe sequences short.
+    //Running out of arena is fatal like MAX_JOBS
+    ConcurrentHashMap(Arena& arena, size_t expected)
+        : slots(nullptr),
+          mask(0)
     {
-        frameArena.reset();
+        size_t size {16};
+        while (size < expected * 2)
+        {
+            size <<= 1;
+        }
+        slots = arena_allocate_array<HashSlot>(arena, size);
+        if (!slots)
+        {
+            std::abort();
+        }
+        mask = size - 1;
+        for (size_t i = 0; i < size; ++i)
+        {
+            slots[i].key.store(HASH_EMPTY_KEY, std::memory_order_relaxed);
+        }
     }
+};
+
+uint64_t hash_u64(uint64_t key) //MurmurHash3 finalizer
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return key;
 }
 
+//False when the table is full, or for HASH_EMPTY_KEY: its slot would still read as empty
+bool hash_map_insert(ConcurrentHashMap& map, uint64_t key, uint64_t value)
+{
+    if (key == HASH_EMPTY_KEY)
+    {
+        return false;
+    }
+    size_t index {static_cast<size_t>(hash_u64(key)) & map.mask};
+    for (size_t probes = 0; probes <= map.mask; ++probes)
+    {
+        HashSlot& slot {map.slots[index]};
+        uint64_t seen {slot.key.load(std::memory_order_relaxed)};
+        if (seen == HASH_EMPTY_KEY && slot.key.compare_exchange_strong(seen, key, std::memory_order_relaxed))
+        {
+            slot.value = value;
+            return true;
+        }
+        index = (index + 1) & map.mask;
+    }
+    return false;
+}
+
+using ProbeFn = void (*)(size_t probe_index, uint64_t value, void* user);
+
+//Calls on_match for every value stored under `key`; returns how many there were
+size_t hash_map_find(const ConcurrentHashMap& map, uint64_t key, size_t probe_index, ProbeFn on_match, void* user)
+{
+    size_t matches {0};
+    size_t index {static_cast<size_t>(hash_u64(key)) & map.mask};
+    for (size_t probes = 0; probes <= map.mask; ++probes)
+    {
+        const HashSlot& slot {map.slots[index]};
+        uint64_t seen {slot.key.load(std::memory_order_relaxed)};
+        if (seen == HASH_EMPTY_KEY)
+        {
+            break;
+        }
+        if (seen == key)
+        {
+            ++matches;
+            if (on_match)
+            {
+                on_match(probe_index, slot.value, user);
+            }
+        }
+        index = (index + 1) & map.mask;
+    }
+    return matches;
+}
+
+struct HashBuildData
+{
+    ConcurrentHashMap* map;
+    const uint64_t* keys;
+    const uint64_t* values; //nullptr stores the row index instead
+    std::atomic<size_t>* failed;
+};
+
+void hash_build_range(size_t begin, size_t end, void* user)
+{
+    auto* data {static_cast<HashBuildData*>(user)};
+    size_t failed {0};
+    for (size_t i = begin; i < end; ++i)
+    {
+        if (!hash_map_insert(*data->map, data->keys[i], data->values ? data->values[i] : i))
+        {
+            ++failed;
+        }
+    }
+    if (failed)
+    {
+        data->failed->fetch_add(failed, std::memory_order_relaxed);
+    }
+}
+
+struct HashProbeData
+{
+    const ConcurrentHashMap* map;
+    const uint64_t* keys;
+    ProbeFn on_match;
+    void* user;
+};
+
+void hash_probe_range(size_t begin, size_t end, void* user)
+{
+    auto* data {static_cast<HashProbeData*>(user)};
+    for (size_t i = begin; i < end; ++i)
+    {
+        hash_map_find(*data->map, data->keys[i], i, data->on_match, data->user);
+    }
+}
+
+//Inserts keys[i] -> values[i] (or -> i) for every row. Rows that didn't fit, or whose key is HASH_EMPTY_KEY,
+//are added to *failed.
+bool parallel_build(JobContext& ctx, ConcurrentHashMap& map, const uint64_t* keys, const uint64_t* values, size_t count,
+                    std::atomic<size_t>* failed, JobCounter* counter, Partitioner part = {PartitionKind::binary, 4096})
+{
+    auto* data {arena_allocate<HashBuildData>(*ctx.arena, HashBuildData{&map, keys, values, failed})};
+    return data && parallel_for(ctx, 0, count, hash_build_range, data, counter, part);
+}
+
+//Calls on_match(i, value) for every stored value matching keys[i]. Run only after the build has drained.
+bool parallel_probe(JobContext& ctx, const ConcurrentHashMap& map, const uint64_t* keys, size_t count,
+                    ProbeFn on_match, void* user, JobCounter* counter, Partitioner part = {PartitionKind::binary, 4096})
+{
+    auto* data {arena_allocate<HashProbeData>(*ctx.arena, HashProbeData{&map, keys, on_match, user})};
+    return data && parallel_for(ctx, 0, count, hash_probe_range, data, counter, part);
+}
+
+//---- Radix partitioning ----
+//One pass = every block histograms its slice of the input, the last block to finish scans the histograms
+//into per-block write offsets, then every block scatters its slice. Blocks are posted one per worker.
+//Scattered keys are staged in a cache line per bucket (software write-combining) and written out a full
+//line at a time, so 256 open output streams don't thrash the cache and TLB.
+constexpr size_t RADIX_BITS{8};
+constexpr size_t RADIX_BUCKETS{size_t{1} << RADIX_BITS};
+constexpr size_t RADIX_WC_KEYS{64 / sizeof(uint64_t)};
+constexpr size_t RADIX_MIN_BLOCK{4096}; //Below this a block isn't worth a job
+
+struct RadixPass;
+
+struct RadixBlockJobData
+{
+    RadixPass* pass;
+    size_t block;
+    MailItem mail;
+};
+
+struct RadixPass
+{
+    const uint64_t* src;
+    uint64_t* dst;
+    size_t count;
+    unsigned shift;
+    size_t digit_mask; //RADIX_BUCKETS - 1, narrower on a sort's last pass when key_bits isn't a multiple of RADIX_BITS
+
+    size_t blocks;
+    size_t* offsets;       //blocks x RADIX_BUCKETS: histograms, turned into write offsets by the scan
+    size_t* bucket_starts; //Optional, RADIX_BUCKETS + 1 bucket boundaries in dst
+    RadixBlockJobData* block_jobs;
+    std::atomic<size_t> pending;
+    bool scattering;
+    JobCounter* counter;
+
+    void (*on_done)(RadixPass& pass, JobContext& ctx); //Run by the last block to finish scattering
+    void* user;
+};
+
+void radix_block_job(void* ptr, JobContext* ctx);
+
+void radix_post_blocks(RadixPass& pass, JobContext& ctx)
+{
+    pass.pending.store(pass.blocks, std::memory_order_relaxed);
+    counter_add(*pass.counter, &ctx, static_cast<int64_t>(pass.blocks));
+    size_t workers {ctx.workers ? std::max<size_t>(ctx.worker_count, 1) : 1};
+    for (size_t b = 0; b < pass.blocks; ++b)
+    {
+        RadixBlockJobData& data {pass.block_jobs[b]};
+        Worker& target {ctx.workers ? ctx.workers[b % workers] : *ctx.worker};
+        post_job(target, &data.mail, Job{radix_block_job, &data, pass.counter, &ctx, true});
+    }
+}
+
+void radix_scan(RadixPass& pass)
+{
+    size_t running {0};
+    for (size_t d = 0; d < RADIX_BUCKETS; ++d)
+    {
+        if (pass.bucket_starts)
+        {
+            pass.bucket_starts[d] = running;
+        }
+        for (size_t b = 0; b < pass.blocks; ++b)
+        {
+            size_t& slot {pass.offsets[b * RADIX_BUCKETS + d]};
+            size_t n {slot};
+            slot = running;
+            running += n;
+        }
+    }
+    if (pass.bucket_starts)
+    {
+        pass.bucket_starts[RADIX_BUCKETS] = running;
+    }
+}
+
+void radix_scatter(RadixPass& pass, size_t block, size_t begin, size_t end)
+{
+    alignas(64) uint64_t staged[RADIX_BUCKETS][RADIX_WC_KEYS];
+    unsigned char fill[RADIX_BUCKETS] {};
+    size_t* offsets {pass.offsets + block * RADIX_BUCKETS};
+
+    for (size_t i = begin; i < end; ++i)
+    {
+        uint64_t key {pass.src[i]};
+        size_t d {static_cast<size_t>(key >> pass.shift) & pass.digit_mask};
+        staged[d][fill[d]++] = key;
+        if (fill[d] == RADIX_WC_KEYS)
+        {
+            std::memcpy(pass.dst + offsets[d], staged[d], sizeof(staged[d]));
+            offsets[d] += RADIX_WC_KEYS;
+            fill[d] = 0;
+        }
+    }
+    for (size_t d = 0; d < RADIX_BUCKETS; ++d)
+    {
+        std::memcpy(pass.dst + offsets[d], staged[d], fill[d] * sizeof(uint64_t));
+        offsets[d] += fill[d];
+    }
+}
+
+void radix_block_job(void* ptr, JobContext* ctx)
+{
+    auto* data {static_cast<RadixBlockJobData*>(ptr)};
+    RadixPass& pass {*data->pass};
+    size_t begin {pass.count * data->block / pass.blocks};
+    size_t end {pass.count * (data->block + 1) / pass.blocks};
+
+    if (!pass.scattering)
+    {
+        size_t* histogram {pass.offsets + data->block * RADIX_BUCKETS};
+        std::fill(histogram, histogram + RADIX_BUCKETS, size_t{0});
+        for (size_t i = begin; i < end; ++i)
+        {
+            ++histogram[static_cast<size_t>(pass.src[i] >> pass.shift) & pass.digit_mask];
+        }
+        if (pass.pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            radix_scan(pass);
+            pass.scattering = true;
+            radix_post_blocks(pass, *ctx);
+        }
+        return;
+    }
+
+    radix_scatter(pass, data->block, begin, end);
+    if (pass.pending.fetch_sub(1, std::memory_order_acq_rel) == 1 && pass.on_done)
+    {
+        pass.on_done(pass, *ctx);
+    }
+}
+
+RadixPass* radix_make_pass(JobContext& ctx, const uint64_t* src, uint64_t* dst, size_t count, unsigned shift, JobCounter* counter)
+{
+    size_t workers {ctx.workers ? std::max<size_t>(ctx.worker_count, 1) : 1};
+    size_t blocks {std::max<size_t>(std::min(workers, count / RADIX_MIN_BLOCK), 1)};
+
+    RadixPass* pass {arena_allocate<RadixPass>(*ctx.arena)};
+    size_t* offsets {arena_allocate_array<size_t>(*ctx.arena, blocks * RADIX_BUCKETS)};
+    RadixBlockJobData* block_jobs {arena_allocate_array<RadixBlockJobData>(*ctx.arena, blocks)};
+    if (!pass || !offsets || !block_jobs)
+    {
+        return nullptr;
+    }
+
+    pass->src = src;
+    pass->dst = dst;
+    pass->count = count;
+    pass->shift = shift;
+    pass->digit_mask = RADIX_BUCKETS - 1;
+    pass->blocks = blocks;
+    pass->offsets = offsets;
+    pass->bucket_starts = nullptr;
+    pass->block_jobs = block_jobs;
+    pass->scattering = false;
+    pass->counter = counter;
+    pass->on_done = nullptr;
+    pass->user = nullptr;
+    for (size_t b = 0; b < blocks; ++b)
+    {
+        block_jobs[b].pass = pass;
+        block_jobs[b].block = b;
+    }
+    return pass;
+}
+
+//Stable partition of src into dst by the RADIX_BITS-wide digit at `shift`.
+//bucket_starts (optional, RADIX_BUCKETS + 1 entries) receives the bucket boundaries in dst.
+bool parallel_radix_partition(JobContext& ctx, const uint64_t* src, uint64_t* dst, size_t count, unsigned shift,
+                              size_t* bucket_starts, JobCounter* counter)
+{
+    if (count == 0)
+    {
+        return true;
+    }
+    RadixPass* pass {radix_make_pass(ctx, src, dst, count, shift, counter)};
+    if (!pass)
+    {
+        return false;
+    }
+    pass->bucket_starts = bucket_starts;
+    radix_post_blocks(*pass, ctx);
+    return true;
+}
+
+struct RadixSortState
+{
+    uint64_t* keys;
+    uint64_t* scratch;
+    unsigned key_bits;
+    unsigned passes;
+    unsigned completed;
+};
+
+size_t radix_sort_digit_mask(unsigned key_bits, unsigned shift)
+{
+    return key_bits - shift < RADIX_BITS ? (size_t{1} << (key_bits - shift)) - 1 : RADIX_BUCKETS - 1;
+}
+
+void radix_sort_next_pass(RadixPass& pass, JobContext& ctx)
+{
+    auto* sort {static_cast<RadixSortState*>(pass.user)};
+    if (++sort->completed == sort->passes)
+    {
+        if (pass.dst != sort->keys)
+        {
+            std::memcpy(sort->keys, pass.dst, pass.count * sizeof(uint64_t)); //Odd pass count: result is in scratch
+        }
+        return;
+    }
+    bool even {sort->completed % 2 == 0};
+    pass.src = even ? sort->keys : sort->scratch;
+    pass.dst = even ? sort->scratch : sort->keys;
+    pass.shift += RADIX_BITS;
+    pass.digit_mask = radix_sort_digit_mask(sort->key_bits, pass.shift);
+    pass.scattering = false;
+    radix_post_blocks(pass, ctx);
+}
+
+//LSD radix sort of the low `key_bits` bits of keys, ping-ponging through `scratch` (same size as keys).
+//Higher bits are ignored, equal low bits keep their input order. With an odd pass count the last pass lands
+//in `scratch` and is copied back: an extra pass would re-sort by bits the caller excluded.
+bool parallel_radix_sort(JobContext& ctx, uint64_t* keys, uint64_t* scratch, size_t count, JobCounter* counter, unsigned key_bits = 64)
+{
+    if (count < 2)
+    {
+        return true;
+    }
+    key_bits = std::min(key_bits, 64u);
+    unsigned passes {static_cast<unsigned>((key_bits + RADIX_BITS - 1) / RADIX_BITS)};
+    if (passes == 0)
+    {
+        return true; //key_bits == 0: every key compares equal, already sorted
+    }
+
+    RadixPass* pass {radix_make_pass(ctx, keys, scratch, count, 0, counter)};
+    RadixSortState* sort {arena_allocate<RadixSortState>(*ctx.arena, RadixSortState{keys, scratch, key_bits, passes, 0})};
+    if (!pass || !sort)
+    {
+        return false;
+    }
+    pass->digit_mask = radix_sort_digit_mask(key_bits, 0);
+    pass->on_done = radix_sort_next_pass;
+    pass->user = sort;
+    radix_post_blocks(*pass, ctx);
+    return true;
+}
+
+//---- Batch jobs ----
+//One job carrying a kernel and a range of payloads. The kernel is a template argument, so the loop over
+//the range calls it directly (inlinable, vectorizable) instead of going through a Job::fn per item.
+constexpr size_t BATCH_DEFAULT_GRAIN{256};
+
+template <typename Payload>
+struct BatchJobData
+{
+    Payload* items;
+    size_t count;
+    size_t grain;
+    JobCounter* counter;
+};
+
+template <typename Payload, void (*Kernel)(Payload& item, JobContext& ctx)>
+void batch_job(void* ptr, JobContext* ctx)
+{
+    auto* data {static_cast<BatchJobData<Payload>*>(ptr)};
+
+    //Peel the back half off for thieves until one grain is left, then run it in a tight loop
+    while (data->count > data->grain)
+    {
+        size_t half {data->count / 2};
+        auto* rest {arena_allocate<BatchJobData<Payload>>(*ctx->arena,
+            BatchJobData<Payload>{data->items + (data->count - half), half, data->grain, data->counter})};
+        if (!rest)
+        {
+            break; //Arena exhausted: run the remainder here
+        }
+        data->count -= half;
+        Job job{batch_job<Payload, Kernel>, rest, data->counter, ctx, true};
+        spawn(*ctx, &job, 1, SpawnPolicy::help_first);
+    }
+
+    for (size_t i = 0; i < data->count; ++i)
+    {
+        Kernel(data->items[i], *ctx);
+    }
+}
+
+//Runs Kernel over items[0, count) as batches of at most `grain` payloads. Returns false if the arena is full.
+template <typename Payload, void (*Kernel)(Payload& item, JobContext& ctx)>
+bool spawn_batch(JobContext& ctx, Payload* items, size_t count, JobCounter* counter, size_t grain = BATCH_DEFAULT_GRAIN)
+{
+    if (count == 0)
+    {
+        return true;
+    }
+    auto* data {arena_allocate<BatchJobData<Payload>>(*ctx.arena,
+        BatchJobData<Payload>{items, count, std::max<size_t>(grain, 1), counter})};
+    if (!data)
+    {
+        return false;
+    }
+    Job job{batch_job<Payload, Kernel>, data, counter, &ctx, true};
+    spawn(ctx, &job, 1, SpawnPolicy::help_first);
+    return true;
+}
+
+//---- Worker-local storage ----
+//One slot per worker, each on its own cache lines and indexed by the running worker's id, so jobs get
+//per-worker scratch and partial results without thread_local lookups or shared atomics. Merge once the
+//jobs have drained. Contexts without a worker (blocking pool tasks) have no slot: worker_local aborts.
+template <typename T>
+struct WorkerLocal //Outlives frames, so it is not arena-allocated
+{
+    struct alignas(64) Slot
+    {
+        T value;
+    };
+    std::vector<Slot> slots;
+
+    explicit WorkerLocal(const JobContext& ctx, const T& initial = T{})
+        : slots(std::max<size_t>(ctx.worker_count, 1), Slot{initial})
+    {}
+};
+
+template <typename T>
+T& worker_local(JobContext& ctx, WorkerLocal<T>& local)
+{
+    if (!ctx.worker)
+    {
+        std::abort(); //No worker (blocking pool task, non-worker thread): any slot we handed out would be shared
+    }
+    return local.slots[ctx.worker->id].value;
+}
+
+//Folds every slot into `init` with combine(T acc, const T& slot)
+template <typename T, typename Combine>
+T worker_local_combine(WorkerLocal<T>& local, T init, Combine combine)
+{
+    for (auto& slot : local.slots)
+    {
+        init = combine(std::move(init), slot.value);
+    }
+    return init;
+}
+
+//Visits every slot, e.g. to splice per-worker buffers together or reset them for the next frame
+template <typename T, typename Fn>
+void worker_local_for_each(WorkerLocal<T>& local, Fn fn)
+{
+    for (auto& slot : local.slots)
+    {
+        fn(slot.value);
+    }
+}
+
+//Indices only ever grow and are masked into the ring, so head/tail never need resetting.
+//The last job can be raced for by the owner and a thief; whoever wins the CAS on head takes it.
+bool pop_local(JobQueue& q, Job& out)
+{
+    size_t t = q.tail.load(std::memory_order_relaxed) - 1;
+    q.tail.store(t,std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    size_t h = q.head.load(std::memory_order_relaxed);
+
+    if(static_cast<std::ptrdiff_t>(t - h) < 0)
+    {
+        q.tail.store(t+1,std::memory_order_relaxed);
+        return false;
+    }
+
+    out = queue_read(q, t);
+    if(t != h)
+    {
+        return true;
+    }
+
+    bool won {q.head.compare_exchange_strong(h, h+1, std::memory_order_seq_cst, std::memory_order_relaxed)};
+    q.tail.store(t+1,std::memory_order_relaxed);
+    return won;
+}
+
+bool steal(JobQueue& victim, Job& out, bool take_latency_critical = true)
+{
+    size_t h = victim.head.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    size_t t = victim.tail.load(std::memory_order_acquire);
+    
+    if(static_cast<std::ptrdiff_t>(t - h) <= 0)
+    {
+        return false;
+    }
+
+    out = queue_read(victim, h);
+    if(!take_latency_critical && out.latency_critical)
+    {
+        return false;
+    }
+    if(!victim.head.compare_exchange_strong(
+        h,h+1,
+        std::memory_order_seq_cst,
+        std::memory_order_relaxed
+    ))
+    {
+        return false;
+    }
+    return true;
+}
+
+//Same-kernel jobs found on top of the ring are run back to back and retired with one counter update.
+//Only the top is checked after each job has run, so children it pushed still go first (depth-first, bounded ring).
+constexpr size_t JOB_BATCH_MAX{8}; //Bounds how long retirement of a run can lag behind
+
+bool queue_top_matches(const JobQueue& q, const Job& job)
+{
+    size_t t {q.tail.load(std::memory_order_relaxed)};
+    return t != q.head.load(std::memory_order_relaxed) && queue_matches(q, t - 1, job);
+}
+
+//Starts loading the payload of the job that would be popped next while the current one runs.
+//Only the payload is known here; jobs that know their input range can prefetch it themselves.
+constexpr size_t JOB_PREFETCH_LINES{2}; //Most payloads fit in one or two cache lines
+
+void prefetch_next_job(const JobQueue& q)
+{
+    size_t t {q.tail.load(std::memory_order_relaxed)};
+    if (t == q.head.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+    //The slot may be stolen meanwhile; prefetching a stale pointer is harmless, it never faults
+    const char* data {static_cast<const char*>(queue_peek_data(q, t - 1))};
+    if (!data)
+    {
+        return;
+    }
+#if defined(__GNUC__) || defined(__clang__)
+    for (size_t i = 0; i < JOB_PREFETCH_LINES; ++i)
+    {
+        __builtin_prefetch(data + i * 64, 0, 3);
+    }
+#endif
+}
+
+//---- Timer wheel ----
+//Hierarchical wheel: level 0 resolves single ticks, every higher level covers 64x the range of the one below.
+//Entries cascade down a level each time the lower wheel wraps, so insert and expiry stay O(1).
+constexpr size_t TIMER_WHEEL_BITS{6};
+constexpr size_t TIMER_WHEEL_SLOTS{size_t{1} << TIMER_WHEEL_BITS};
+constexpr size_t TIMER_WHEEL_LEVELS{3}; //64^3 ticks of reach, later deadlines are parked on the top level and re-cascaded
+
+struct TimerEntry //Storage is owned by the caller (usually the frame arena) and must outlive the firing
+{
+    Job job;
+    uint64_t due_tick;
+    TimerEntry* next;
+};
+
+struct TimerWheel
+{
+    TimerEntry* slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    uint64_t current_tick;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::microseconds tick;
+
+    TimerEntry* due_head;            //Expired entries that didn't fit in the servicing worker's ring yet
+    TimerEntry* due_tail;
+
+    std::atomic<TimerEntry*> inbox;  //Any thread schedules by pushing here, only the servicing worker touches slots and due
+    std::atomic<bool> servicing;     //Held by the one worker currently advancing the wheel
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    explicit TimerWheel(std::chrono::microseconds tick = std::chrono::milliseconds{1})
+        : slots{},
+          current_tick(0),
+          start(std::chrono::steady_clock::now()),
+          tick(tick),
+          due_head(nullptr),
+          due_tail(nullptr),
+          inbox(nullptr),
+          servicing(false)
+    {}
+};
+
+uint64_t timer_now_tick(const TimerWheel& wheel)
+{
+    return static_cast<uint64_t>((std::chrono::steady_clock::now() - wheel.start) / wheel.tick);
+}
+
+//Schedules `job` to be pushed onto a worker queue once `delay` has elapsed.
+//Like push_job, the counter is incremented here so workers stay alive while the timer is pending.
+//Periodic work re-arms itself by calling schedule_after again from inside the job.
+template <typename Rep, typename Period>
+void schedule_after(TimerWheel& wheel, TimerEntry* entry, std::chrono::duration<Rep, Period> delay, Job job)
+{
+    //Round the absolute due time up to a tick: an entry fires once floor(elapsed / tick) reaches due_tick,
+    //so flooring here (or adding whole ticks to a floored now) could fire up to a tick early
+    std::chrono::nanoseconds tick {wheel.tick};
+    std::chrono::nanoseconds wait {std::max(std::chrono::ceil<std::chrono::nanoseconds>(delay), std::chrono::nanoseconds{0})};
+    std::chrono::nanoseconds due {std::chrono::steady_clock::now() - wheel.start + wait};
+    entry->job = job;
+    entry->due_tick = static_cast<uint64_t>((due + tick - std::chrono::nanoseconds{1}) / tick);
+
+    if (job.is_leaf && job.counter)
+    {
+        counter_add(*job.counter, nullptr, 1);
+    }
+
+    TimerEntry* head {wheel.inbox.load(std::memory_order_relaxed)};
+    do
+    {
+        entry->next = head;
+    } while (!wheel.inbox.compare_exchange_weak(head, entry, std::memory_order_release, std::memory_order_relaxed));
+}
+
+//Returns false when the entry is already due and was not linked into the wheel
+bool timer_place(TimerWheel& wheel, TimerEntry* entry)
+{
+    if (entry->due_tick <= wheel.current_tick)
+    {
+        return false;
+    }
+
+    constexpr uint64_t reach {uint64_t{1} << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)};
+    uint64_t delta {entry->due_tick - wheel.current_tick};
+    uint64_t place {delta < reach ? entry->due_tick : wheel.current_tick + reach - 1};
+
+    size_t level {0};
+    while (level + 1 < TIMER_WHEEL_LEVELS && delta >= (uint64_t{1} << (TIMER_WHEEL_BITS * (level + 1))))
+    {
+        ++level;
+    }
+
+    size_t slot {static_cast<size_t>((place >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1))};
+    entry->next = wheel.slots[level][slot];
+    wheel.slots[level][slot] = entry;
+    return true;
+}
+
+//Called by idle workers between pop_local and steal. Due jobs are pushed onto the calling worker's queue.
+//Returns the number of jobs released; 0 when nothing was due or another worker is already servicing.
+size_t poll_timers(TimerWheel& wheel, Worker& worker)
+{
+    if (wheel.servicing.exchange(true, std::memory_order_acquire))
+    {
+        return 0;
+    }
+
+    //Expired entries queue up in firing order and are released as far as the ring has room
+    auto fire = [&](TimerEntry* entry)
+    {
+        entry->next = nullptr;
+        if (wheel.due_tail)
+        {
+            wheel.due_tail->next = entry;
+        }
+        else
+        {
+            wheel.due_head = entry;
+        }
+        wheel.due_tail = entry;
+    };
+
+    TimerEntry* pending {wheel.inbox.exchange(nullptr, std::memory_order_acquire)};
+    while (pending)
+    {
+        TimerEntry* next {pending->next};
+        if (!timer_place(wheel, pending))
+        {
+            fire(pending);
+        }
+        pending = next;
+    }
+
+    uint64_t now {timer_now_tick(wheel)};
+    while (wheel.current_tick < now)
+    {
+        ++wheel.current_tick;
+
+        //Cascade from the top down so an entry can fall through several levels on the same tick
+        for (size_t level = TIMER_WHEEL_LEVELS - 1; level > 0; --level)
+        {
+            uint64_t level_mask {(uint64_t{1} << (TIMER_WHEEL_BITS * level)) - 1};
+            if ((wheel.current_tick & level_mask) != 0)
+            {
+                continue;
+            }
+            size_t slot {static_cast<size_t>((wheel.current_tick >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1))};
+            TimerEntry* entry {wheel.slots[level][slot]};
+            wheel.slots[level][slot] = nullptr;
+            while (entry)
+            {
+                TimerEntry* next {entry->next};
+                if (!timer_place(wheel, entry))
+                {
+                    fire(entry);
+                }
+                entry = next;
+            }
+        }
+
+        size_t slot {static_cast<size_t>(wheel.current_tick & (TIMER_WHEEL_SLOTS - 1))};
+        TimerEntry* entry {wheel.slots[0][slot]};
+        wheel.slots[0][slot] = nullptr;
+        while (entry)
+        {
+            TimerEntry* next {entry->next};
+            fire(entry);
+            entry = next;
+        }
+    }
+
+    size_t fired {0};
+    while (wheel.due_head && ring_has_room(worker))
+    {
+        TimerEntry* entry {wheel.due_head};
+        wheel.due_head = entry->next;
+        if (!wheel.due_head)
+        {
+            wheel.due_tail = nullptr;
+        }
+        push_job(worker, entry->job);
+        ++fired;
+    }
+
+    wheel.servicing.store(false, std::memory_order_release);
+    return fired;
+}
+
+//---- Async I/O ----
+//Jobs hand reads/writes to an io_uring and return; the continuation is pushed as a Job when the CQE arrives.
+//Like the timer wheel, submitters only push onto a lock-free inbox and idle workers take turns servicing the ring.
+constexpr unsigned IO_RING_ENTRIES{64};
+
+struct IoRequest //Caller-owned like TimerEntry. `result` is bytes transferred or -errno once the continuation runs
+{
+    int fd;
+    void* buffer;
+    unsigned length;
+    uint64_t offset;
+    bool write;
+    int result;
+    Job continuation;
+    IoRequest* next;
+};
+
+struct IoRing
+{
+    int fd; //-1 when io_uring is unavailable, requests then complete synchronously inside poll_io
+
+#if defined(__linux__)
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    io_uring_sqe* sqes;
+
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    io_uring_cqe* cqes;
+
+    void* sq_map;
+    size_t sq_map_size;
+    void* cq_map;
+    size_t cq_map_size;
+    size_t sqes_size;
+    unsigned cq_entries;
+#endif
+
+    //Only touched by the servicing worker
+    unsigned in_flight;
+    IoRequest* backlog;
+    IoRequest* backlog_tail;
+    bool submit_failed; //io_uring_enter failed for good, the backlog runs through the blocking fallback
+
+    std::atomic<IoRequest*> inbox;
+    std::atomic<size_t> pending; //Submitted requests whose continuation hasn't been released yet
+    std::atomic<bool> servicing;
+
+    IoRing(const IoRing&) = delete;
+    IoRing& operator=(const IoRing&) = delete;
+
+    explicit IoRing(unsigned entries = IO_RING_ENTRIES)
+        : fd(-1),
+          in_flight(0),
+          backlog(nullptr),
+          backlog_tail(nullptr),
+          submit_failed(false),
+          inbox(nullptr),
+          pending(0),
+          servicing(false)
+    {
+#if defined(__linux__)
+        io_uring_params params{};
+        int ring_fd {static_cast<int>(syscall(__NR_io_uring_setup, entries, &params))};
+        if (ring_fd < 0)
+        {
+            return;
+        }
+
+        sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+
+        sq_map = mmap(nullptr, sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+        cq_map = mmap(nullptr, cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+        void* sqe_map = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+        if (sq_map == MAP_FAILED || cq_map == MAP_FAILED || sqe_map == MAP_FAILED)
+        {
+            if (sq_map != MAP_FAILED) munmap(sq_map, sq_map_size);
+            if (cq_map != MAP_FAILED) munmap(cq_map, cq_map_size);
+            if (sqe_map != MAP_FAILED) munmap(sqe_map, sqes_size);
+            close(ring_fd);
+            return;
+        }
+
+        char* sq {static_cast<char*>(sq_map)};
+        sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        sqes = static_cast<io_uring_sqe*>(sqe_map);
+
+        char* cq {static_cast<char*>(cq_map)};
+        cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        cq_entries = params.cq_entries;
+
+        fd = ring_fd;
+#else
+        (void)entries;
+#endif
+    }
+
+    ~IoRing()
+    {
+#if defined(__linux__)
+        if (fd >= 0)
+        {
+            munmap(sqes, sqes_size);
+            munmap(cq_map, cq_map_size);
+            munmap(sq_map, sq_map_size);
+            close(fd);
+        }
+#endif
+    }
+};
+
+void submit_io(IoRing& ring, IoRequest* req)
+{
+    //The continuation is future work, so it is counted before the request becomes visible
+    if (req->continuation.is_leaf && req->continuation.counter)
+    {
+        counter_add(*req->continuation.counter, nullptr, 1);
+    }
+    ring.pending.fetch_add(1, std::memory_order_relaxed);
+
+    IoRequest* head {ring.inbox.load(std::memory_order_relaxed)};
+    do
+    {
+        req->next = head;
+    } while (!ring.inbox.compare_exchange_weak(head, req, std::memory_order_release, std::memory_order_relaxed));
+}
+
+void io_read(IoRing& ring, IoRequest* req, int fd, void* buffer, unsigned length, uint64_t offset, Job continuation)
+{
+    *req = IoRequest{fd, buffer, length, offset, false, 0, continuation, nullptr};
+    submit_io(ring, req);
+}
+
+void io_write(IoRing& ring, IoRequest* req, int fd, const void* buffer, unsigned length, uint64_t offset, Job continuation)
+{
+    *req = IoRequest{fd, const_cast<void*>(buffer), length, offset, true, 0, continuation, nullptr};
+    submit_io(ring, req);
+}
+
+//Used when the kernel refuses io_uring (old kernels, seccomp'd containers). Blocks the servicing worker.
+int io_blocking_fallback(IoRequest* req)
+{
+#if defined(__linux__)
+    ssize_t n {req->write ? pwrite(req->fd, req->buffer, req->length, static_cast<off_t>(req->offset))
+                          : pread(req->fd, req->buffer, req->length, static_cast<off_t>(req->offset))};
+    return n < 0 ? -errno : static_cast<int>(n);
+#else
+    (void)req;
+    return -ENOSYS;
+#endif
+}
+
+#if defined(__linux__)
+//io_uring_enter failed for a reason retrying won't fix: takes the SQEs the kernel never consumed back out
+//of the SQ and returns their requests to the front of the backlog, in order
+void io_retract_unsubmitted(IoRing& ring, unsigned tail)
+{
+    unsigned head {__atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE)};
+    while (tail != head)
+    {
+        --tail;
+        auto* req {reinterpret_cast<IoRequest*>(ring.sqes[tail & *ring.sq_mask].user_data)};
+        req->next = ring.backlog;
+        ring.backlog = req;
+        if (!ring.backlog_tail)
+        {
+            ring.backlog_tail = req;
+        }
+        --ring.in_flight;
+    }
+    __atomic_store_n(ring.sq_tail, head, __ATOMIC_RELEASE);
+    ring.submit_failed = true;
+}
+#endif
+
+//Called by idle workers between pop_local and steal: submits queued requests and pushes finished continuations
+//onto the calling worker's queue, as far as it has room. Never waits for the kernel.
+size_t poll_io(IoRing& ring, Worker& worker)
+{
+    if (ring.pending.load(std::memory_order_acquire) == 0 || !ring_has_room(worker))
+    {
+        return 0;
+    }
+    if (ring.servicing.exchange(true, std::memory_order_acquire))
+    {
+        return 0;
+    }
+
+    //Inbox is LIFO, reverse it so requests reach the kernel in submission order
+    IoRequest* pending {ring.inbox.exchange(nullptr, std::memory_order_acquire)};
+    IoRequest* ordered {nullptr};
+    while (pending)
+    {
+        IoRequest* next {pending->next};
+        pending->next = ordered;
+        ordered = pending;
+        pending = next;
+    }
+    if (ordered)
+    {
+        if (ring.backlog_tail)
+        {
+            ring.backlog_tail->next = ordered;
+        }
+        else
+        {
+            ring.backlog = ordered;
+        }
+        while (ordered->next)
+        {
+            ordered = ordered->next;
+        }
+        ring.backlog_tail = ordered;
+    }
+
+    size_t completed {0};
+    auto complete = [&](IoRequest* req, int result)
+    {
+        req->result = result;
+        push_job(worker, req->continuation);
+        ring.pending.fetch_sub(1, std::memory_order_relaxed);
+        ++completed;
+    };
+
+#if defined(__linux__)
+    if (ring.fd >= 0)
+    {
+        //Never put more requests in flight than the CQ can hold
+        unsigned tail {*ring.sq_tail};
+        while (!ring.submit_failed && ring.backlog && ring.in_flight < ring.cq_entries
+               && tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE) <= *ring.sq_mask)
+        {
+            IoRequest* req {ring.backlog};
+            ring.backlog = req->next;
+
+            unsigned index {tail & *ring.sq_mask};
+            io_uring_sqe& sqe {ring.sqes[index]};
+            sqe = io_uring_sqe{};
+            sqe.opcode = req->write ? IORING_OP_WRITE : IORING_OP_READ;
+            sqe.fd = req->fd;
+            sqe.addr = reinterpret_cast<uint64_t>(req->buffer);
+            sqe.len = req->length;
+            sqe.off = req->offset;
+            sqe.user_data = reinterpret_cast<uint64_t>(req);
+            ring.sq_array[index] = index;
+
+            ++tail;
+            ++ring.in_flight;
+        }
+        if (!ring.backlog)
+        {
+            ring.backlog_tail = nullptr;
+        }
+        __atomic_store_n(ring.sq_tail, tail, __ATOMIC_RELEASE);
+
+        //Submits everything the kernel hasn't consumed yet, including what an earlier short or interrupted
+        //submission left behind in the SQ
+        unsigned unsubmitted {tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE)};
+        if (unsubmitted > 0 && syscall(__NR_io_uring_enter, ring.fd, unsubmitted, 0, 0, nullptr, 0) < 0
+            && errno != EAGAIN && errno != EBUSY && errno != EINTR)
+        {
+            io_retract_unsubmitted(ring, tail);
+        }
+
+        //CQEs left behind stay counted in in_flight, which keeps the CQ from overflowing until they're reaped
+        unsigned head {*ring.cq_head};
+        while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE) && ring_has_room(worker))
+        {
+            io_uring_cqe& cqe {ring.cqes[head & *ring.cq_mask]};
+            complete(reinterpret_cast<IoRequest*>(cqe.user_data), cqe.res);
+            --ring.in_flight;
+            ++head;
+        }
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+#endif
+
+    //No io_uring, or it stopped taking submissions: the backlog completes synchronously
+    if (ring.fd < 0 || ring.submit_failed)
+    {
+        while (ring.backlog && ring_has_room(worker))
+        {
+            IoRequest* req {ring.backlog};
+            ring.backlog = req->next;
+            complete(req, io_blocking_fallback(req));
+        }
+        if (!ring.backlog)
+        {
+            ring.backlog_tail = nullptr;
+        }
+    }
+
+    ring.servicing.store(false, std::memory_order_release);
+    return completed;
+}
+
+//---- Blocking pool ----
+//Jobs that sleep in syscalls would stall a compute worker and everything queued behind it on its deque.
+//submit_blocking runs them on an elastic side pool instead; their continuations come back to the compute workers.
+//Aux threads exist precisely to block, so this is the one place where a mutex/condvar is the right tool.
+struct BlockingTask //Caller-owned like TimerEntry
+{
+    Job job;
+    Job continuation; //fn == nullptr for fire-and-forget
+    BlockingTask* next;
+};
+
+struct BlockingPool
+{
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable drained;
+    BlockingTask* head;
+    BlockingTask* tail;
+    size_t live;
+    size_t idle;
+    size_t wakeups; //Idle threads already notified for a task, they leave `idle` only once they run again
+    size_t max_threads;
+    std::chrono::milliseconds idle_timeout; //Aux threads retire after sitting idle this long
+    bool stopping;
+
+    std::atomic<BlockingTask*> finished; //Continuations waiting for a compute worker to pick them up
+
+    BlockingPool(const BlockingPool&) = delete;
+    BlockingPool& operator=(const BlockingPool&) = delete;
+
+    explicit BlockingPool(size_t max_threads = 64, std::chrono::milliseconds idle_timeout = std::chrono::milliseconds{500})
+        : head(nullptr),
+          tail(nullptr),
+          live(0),
+          idle(0),
+          wakeups(0),
+          max_threads(max_threads),
+          idle_timeout(idle_timeout),
+          stopping(false),
+          finished(nullptr)
+    {}
+
+    ~BlockingPool()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        stopping = true;
+        wake.notify_all();
+        drained.wait(lock, [this] { return live == 0; });
+    }
+};
+
+void blocking_thread(BlockingPool* pool)
+{
+    std::unique_lock<std::mutex> lock(pool->mutex);
+    while (true)
+    {
+        if (!pool->head)
+        {
+            ++pool->idle;
+            bool woke {pool->wake.wait_for(lock, pool->idle_timeout, [pool] { return pool->head || pool->stopping; })};
+            --pool->idle;
+            pool->wakeups = std::min(pool->wakeups, pool->idle);
+            if (!woke || !pool->head)
+            {
+                break; //Idle timeout or shutdown: shrink the pool
+            }
+        }
+
+        BlockingTask* task {pool->head};
+        pool->head = task->next;
+        if (!pool->head)
+        {
+            pool->tail = nullptr;
+        }
+        if (pool->wakeups > 0)
+        {
+            --pool->wakeups; //Whoever runs it, a task a thread was notified for is gone
+        }
+
+        lock.unlock();
+        //The creator's ring and arena are owner-only, so the job keeps the shared services (timers, I/O,
+        //mailboxes, this pool) but runs without a worker or arena
+        JobContext aux {task->job.ctx ? *task->job.ctx : JobContext{}};
+        aux.worker = nullptr;
+        aux.arena = nullptr;
+        execute_job(task->job, &aux);
+        if (task->continuation.fn)
+        {
+            BlockingTask* done {pool->finished.load(std::memory_order_relaxed)};
+            do
+            {
+                task->next = done;
+            } while (!pool->finished.compare_exchange_weak(done, task, std::memory_order_release, std::memory_order_relaxed));
+        }
+        lock.lock();
+    }
+
+    --pool->live;
+    pool->drained.notify_all(); //Still under the lock, so the destructor can't free the condvar under us
+}
+
+void submit_blocking(BlockingPool& pool, BlockingTask* task, Job job, Job continuation)
+{
+    task->job = job;
+    task->continuation = continuation;
+    task->next = nullptr;
+
+    //Both halves are future work, count them before either becomes visible
+    if (job.is_leaf && job.counter)
+    {
+        counter_add(*job.counter, nullptr, 1);
+    }
+    if (continuation.fn && continuation.is_leaf && continuation.counter)
+    {
+        counter_add(*continuation.counter, nullptr, 1);
+    }
+
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    if (pool.tail)
+    {
+        pool.tail->next = task;
+    }
+    else
+    {
+        pool.head = task;
+    }
+    pool.tail = task;
+
+    //Each task claims its own idle thread: a notified thread stays in `idle` until it wakes up, so back to
+    //back submits would otherwise both notify it and the second task would wait behind the first.
+    //Grow only when every existing aux thread is stuck in a job or already claimed
+    if (pool.idle > pool.wakeups)
+    {
+        ++pool.wakeups;
+        pool.wake.notify_one();
+    }
+    else if (pool.live < pool.max_threads)
+    {
+        ++pool.live;
+        std::thread(blocking_thread, &pool).detach();
+    }
+}
+
+//Called by idle compute workers: moves finished blocking jobs' continuations onto the local queue, as far as
+//it has room. Whatever doesn't fit goes back on `finished` for the next poll, here or on another worker.
+size_t poll_blocking(BlockingPool& pool, Worker& worker)
+{
+    if (!pool.finished.load(std::memory_order_relaxed) || !ring_has_room(worker))
+    {
+        return 0;
+    }
+
+    size_t released {0};
+    BlockingTask* done {pool.finished.exchange(nullptr, std::memory_order_acquire)};
+    while (done && ring_has_room(worker))
+    {
+        BlockingTask* next {done->next};
+        push_job(worker, done->continuation);
+        ++released;
+        done = next;
+    }
+
+    if (done)
+    {
+        BlockingTask* last {done};
+        while (last->next)
+        {
+            last = last->next;
+        }
+        BlockingTask* head {pool.finished.load(std::memory_order_relaxed)};
+        do
+        {
+            last->next = head;
+        } while (!pool.finished.compare_exchange_weak(head, done, std::memory_order_release, std::memory_order_relaxed));
+    }
+    return released;
+}
+
+//---- Memory-mapped file processing ----
+//Maps a file read-only and hands page-aligned chunks of whole records to jobs. Nothing is copied:
+//each job gets pointers straight into the page cache.
+#if defined(__linux__)
+using RecordChunkFn = void (*)(const char* begin, const char* end, void* user);
+
+struct MappedFile
+{
+    const char* data; //nullptr when the file could not be opened or is empty
+    size_t size;
+    int fd;
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    explicit MappedFile(const char* path)
+        : data(nullptr),
+          size(0),
+          fd(open(path, O_RDONLY))
+    {
+        struct stat st{};
+        if (fd < 0 || fstat(fd, &st) != 0 || st.st_size <= 0)
+        {
+            return;
+        }
+
+        void* mem {mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0)};
+        if (mem == MAP_FAILED)
+        {
+            return;
+        }
+        size = static_cast<size_t>(st.st_size);
+        madvise(mem, size, MADV_SEQUENTIAL); //Aggressive kernel readahead, pages behind the consumers can go early
+        data = static_cast<const char*>(mem);
+    }
+
+    ~MappedFile()
+    {
+        if (data)
+        {
+            munmap(const_cast<char*>(data), size);
+        }
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+    }
+};
+
+struct MappedFileRun;
+
+struct MappedRangeJobData
+{
+    MappedFileRun* run;
+    size_t first; //Chunk indices [first, last)
+    size_t last;
+};
+
+struct MappedFileRun //Shared by every job of one process_mapped_file call
+{
+    const MappedFile* file;
+    size_t chunk_bytes;
+    size_t chunk_count;
+    size_t prefetch_distance;
+    char delimiter;
+    RecordChunkFn fn;
+    void* user;
+    JobCounter* counter;
+
+    //Binary splitting down to single chunks needs < 2 nodes per chunk, plus one per prefetch job.
+    //They are carved out up front so jobs running on other workers never allocate from the shared arena.
+    MappedRangeJobData* nodes;
+    size_t node_capacity;
+    std::atomic<size_t> next_node;
+
+    MappedRangeJobData* take_node(size_t first, size_t last)
+    {
+        size_t index {next_node.fetch_add(1, std::memory_order_relaxed)};
+        if (index >= node_capacity)
+        {
+            return nullptr;
+        }
+        nodes[index] = MappedRangeJobData{this, first, last};
+        return &nodes[index];
+    }
+};
+
+void mapped_prefetch_job(void* ptr, JobContext*)
+{
+    auto* data {static_cast<MappedRangeJobData*>(ptr)};
+    MappedFileRun* run {data->run};
+    size_t begin {data->first * run->chunk_bytes};
+    size_t end {std::min(begin + run->chunk_bytes, run->file->size)};
+    //Chunk offsets are page-aligned, so this is a valid madvise range
+    madvise(const_cast<char*>(run->file->data) + begin, end - begin, MADV_WILLNEED);
+}
+
+void mapped_range_job(void* ptr, JobContext* ctx)
+{
+    auto* data {static_cast<MappedRangeJobData*>(ptr)};
+    MappedFileRun* run {data->run};
+
+    if (data->last - data->first > 1)
+    {
+        size_t mid {data->first + (data->last - data->first) / 2};
+        MappedRangeJobData* left {run->take_node(data->first, mid)};
+        MappedRangeJobData* right {run->take_node(mid, data->last)};
+
+        counter_add(*run->counter, ctx, 2);
+        push_job(*ctx->worker, Job{mapped_range_job, left, run->counter, ctx, true});
+        push_job(*ctx->worker, Job{mapped_range_job, right, run->counter, ctx, true});
+        return;
+    }
+
+    //Keep the kernel `prefetch_distance` chunks ahead of whoever is consuming this one
+    size_t ahead {data->first + run->prefetch_distance};
+    if (run->prefetch_distance > 0 && ahead < run->chunk_count)
+    {
+        if (MappedRangeJobData* prefetch {run->take_node(ahead, ahead + 1)})
+        {
+            counter_add(*run->counter, ctx, 1);
+            push_job(*ctx->worker, Job{mapped_prefetch_job, prefetch, run->counter, ctx, true});
+        }
+    }
+
+    //A record belongs to the chunk it starts in: skip the partial record at our start
+    //and run past our end to finish the one that straddles it
+    const char* base {run->file->data};
+    size_t size {run->file->size};
+    size_t begin {data->first * run->chunk_bytes};
+    size_t end {std::min(begin + run->chunk_bytes, size)};
+    if (begin != 0)
+    {
+        const void* hit {std::memchr(base + begin - 1, run->delimiter, size - (begin - 1))};
+        begin = hit ? static_cast<size_t>(static_cast<const char*>(hit) - base) + 1 : size;
+    }
+    if (end < size)
+    {
+        const void* hit {std::memchr(base + end - 1, run->delimiter, size - (end - 1))};
+        end = hit ? static_cast<size_t>(static_cast<const char*>(hit) - base) + 1 : size;
+    }
+    if (begin < end)
+    {
+        run->fn(base + begin, base + end, run->user);
+    }
+}
+
+//Splits `file` into page-aligned chunks of about `chunk_bytes` and calls `fn` once per chunk with a span
+//of whole `delimiter`-terminated records. Bookkeeping comes from ctx.arena; returns false if it doesn't fit.
+bool process_mapped_file(
+    JobContext& ctx,
+    const MappedFile& file,
+    RecordChunkFn fn,
+    void* user,
+    JobCounter* counter,
+    char delimiter = '\n',
+    size_t chunk_bytes = size_t{1} << 20,
+    size_t prefetch_distance = 4
+)
+{
+    if (!file.data)
+    {
+        return true;
+    }
+
+    size_t page {static_cast<size_t>(sysconf(_SC_PAGESIZE))};
+    chunk_bytes = std::max(page, (chunk_bytes + page - 1) / page * page);
+    size_t chunk_count {(file.size + chunk_bytes - 1) / chunk_bytes};
+
+    MappedFileRun* run {arena_allocate<MappedFileRun>(*ctx.arena)};
+    size_t node_capacity {3 * chunk_count};
+    MappedRangeJobData* nodes {arena_allocate_array<MappedRangeJobData>(*ctx.arena, node_capacity)};
+    if (!run || !nodes)
+    {
+        return false;
+    }
+
+    run->file = &file;
+    run->chunk_bytes = chunk_bytes;
+    run->chunk_count = chunk_count;
+    run->prefetch_distance = prefetch_distance;
+    run->delimiter = delimiter;
+    run->fn = fn;
+    run->user = user;
+    run->counter = counter;
+    run->nodes = nodes;
+    run->node_capacity = node_capacity;
+    run->next_node.store(0, std::memory_order_relaxed);
+
+    //The first window has no consumer ahead of it to request it
+    size_t warm {std::min(prefetch_distance, chunk_count) * chunk_bytes};
+    madvise(const_cast<char*>(file.data), std::min(warm, file.size), MADV_WILLNEED);
+
+    counter_add(*counter, &ctx, 1);
+    push_job(*ctx.worker, Job{mapped_range_job, run->take_node(0, chunk_count), counter, &ctx, true});
+    return true;
+}
+#endif
+
+//---- Parallel pipeline ----
+//Items flow through a chain of stages, each item carried by a token. At most `max_tokens` items are in flight,
+//which is what gives backpressure: input stalls until the oldest token retires.
+//Stage 0 is the serial input: called with item == nullptr, it returns the next item or nullptr once exhausted.
+enum class StageMode
+{
+    serial_in_order,     //One item at a time, in input order
+    serial_out_of_order, //One item at a time, whichever arrives first
+    parallel             //Any number of items at once
+};
+
+using StageFn = void* (*)(void* item, void* user); //Returns the item handed to the next stage
+
+struct PipelineStage
+{
+    StageMode mode;
+    StageFn fn;
+    void* user;
+};
+
+struct PipelineRun;
+
+struct PipelineToken
+{
+    PipelineRun* run;
+    void* item;
+    size_t seq;   //Position in input order
+    size_t stage; //Next stage to run
+    PipelineToken* next;
+    std::atomic<bool> in_use;
+};
+
+struct PipelineStageState
+{
+    std::atomic<size_t> next_seq;        //serial_in_order: seq allowed in next
+    std::atomic<PipelineToken*> inbox;   //serial_out_of_order: tokens waiting for the stage
+    std::atomic<size_t> pending;         //serial_out_of_order: the token that takes this from 0 runs the stage
+};
+
+struct PipelineRun
+{
+    const PipelineStage* stages;
+    size_t stage_count;
+    PipelineStageState* state;
+
+    //Token seq s lives in tokens[s % max_tokens]; in-order stages park it in parked[stage * max_tokens + s % max_tokens]
+    PipelineToken* tokens;
+    std::atomic<size_t>* parked;
+    size_t max_tokens;
+
+    size_t next_input; //Only touched by the input job, of which there is at most one at a time
+    std::atomic<bool> input_parked;
+    JobCounter* counter;
+};
+
+void pipeline_input_job(void* ptr, JobContext* ctx);
+void pipeline_token_job(void* ptr, JobContext* ctx);
+
+void pipeline_push(PipelineRun* run, JobContext* ctx, void (*fn)(void*, JobContext*), void* data)
+{
+    counter_add(*run->counter, ctx, 1);
+    push_job(*ctx->worker, Job{fn, data, run->counter, ctx, true});
+}
+
+//Parks the token if an earlier seq still has to pass; the token ahead of it re-pushes it on the way out.
+//Slots hold seq + 1 rather than the token: seqs are never reused, so a stale CAS can't match a later park.
+bool pipeline_enter_in_order(PipelineRun* run, PipelineToken* token)
+{
+    PipelineStageState& state {run->state[token->stage]};
+    size_t seq {token->seq};
+    if (state.next_seq.load(std::memory_order_acquire) == seq)
+    {
+        return true;
+    }
+
+    std::atomic<size_t>& slot {run->parked[token->stage * run->max_tokens + seq % run->max_tokens]};
+    slot.store(seq + 1, std::memory_order_seq_cst);
+    //From here on the token may already be running elsewhere, only locals are safe to touch.
+    //Our predecessor may have left between the check and the park, in which case nobody would wake us
+    if (state.next_seq.load(std::memory_order_seq_cst) == seq)
+    {
+        size_t expected {seq + 1};
+        return slot.compare_exchange_strong(expected, 0, std::memory_order_seq_cst);
+    }
+    return false;
+}
+
+void pipeline_leave_in_order(PipelineRun* run, PipelineToken* token, JobContext* ctx)
+{
+    PipelineStageState& state {run->state[token->stage]};
+    size_t successor {token->seq + 1};
+    state.next_seq.store(successor, std::memory_order_seq_cst);
+
+    std::atomic<size_t>& slot {run->parked[token->stage * run->max_tokens + successor % run->max_tokens]};
+    size_t expected {successor + 1};
+    if (slot.compare_exchange_strong(expected, 0, std::memory_order_seq_cst))
+    {
+        pipeline_push(run, ctx, pipeline_token_job, &run->tokens[successor % run->max_tokens]);
+    }
+}
+
+//Whoever bumps `pending` from 0 owns the stage and drains every queued token through it.
+//Returns true when our own token went through and may continue inline.
+bool pipeline_run_exclusive(PipelineRun* run, PipelineToken* token, JobContext* ctx)
+{
+    const PipelineStage& stage {run->stages[token->stage]};
+    PipelineStageState& state {run->state[token->stage]};
+
+    PipelineToken* head {state.inbox.load(std::memory_order_relaxed)};
+    do
+    {
+        token->next = head;
+    } while (!state.inbox.compare_exchange_weak(head, token, std::memory_order_release, std::memory_order_relaxed));
+
+    if (state.pending.fetch_add(1, std::memory_order_acq_rel) != 0)
+    {
+        return false;
+    }
+
+    bool self_done {false};
+    do
+    {
+        //Single consumer, so popping the Treiber stack is ABA-free
+        PipelineToken* next_token {state.inbox.load(std::memory_order_acquire)};
+        while (!state.inbox.compare_exchange_weak(next_token, next_token->next, std::memory_order_acquire, std::memory_order_acquire))
+        {}
+
+        next_token->item = stage.fn(next_token->item, stage.user);
+        if (next_token == token)
+        {
+            self_done = true;
+        }
+        else
+        {
+            ++next_token->stage;
+            pipeline_push(run, ctx, pipeline_token_job, next_token);
+        }
+    } while (state.pending.fetch_sub(1, std::memory_order_acq_rel) != 1);
+
+    return self_done;
+}
+
+void pipeline_retire(PipelineToken* token, JobContext* ctx)
+{
+    PipelineRun* run {token->run};
+    token->in_use.store(false, std::memory_order_seq_cst);
+    if (run->input_parked.exchange(false, std::memory_order_seq_cst))
+    {
+        pipeline_push(run, ctx, pipeline_input_job, run);
+    }
+}
+
+void pipeline_advance(PipelineToken* token, JobContext* ctx)
+{
+    PipelineRun* run {token->run};
+    while (token->stage < run->stage_count)
+    {
+        const PipelineStage& stage {run->stages[token->stage]};
+        switch (stage.mode)
+        {
+        case StageMode::parallel:
+            token->item = stage.fn(token->item, stage.user);
+            break;
+        case StageMode::serial_in_order:
+            if (!pipeline_enter_in_order(run, token))
+            {
+                return;
+            }
+            token->item = stage.fn(token->item, stage.user);
+            pipeline_leave_in_order(run, token, ctx);
+            break;
+        case StageMode::serial_out_of_order:
+            if (!pipeline_run_exclusive(run, token, ctx))
+            {
+                return;
+            }
+            break;
+        }
+        ++token->stage;
+    }
+    pipeline_retire(token, ctx);
+}
+
+void pipeline_token_job(void* ptr, JobContext* ctx)
+{
+    pipeline_advance(static_cast<PipelineToken*>(ptr), ctx);
+}
+
+void pipeline_input_job(void* ptr, JobContext* ctx)
+{
+    auto* run {static_cast<PipelineRun*>(ptr)};
+    PipelineToken* token {&run->tokens[run->next_input % run->max_tokens]};
+
+    //Backpressure: the slot still holds the token max_tokens items back, wait for it to retire
+    if (token->in_use.load(std::memory_order_acquire))
+    {
+        run->input_parked.store(true, std::memory_order_seq_cst);
+        if (token->in_use.load(std::memory_order_seq_cst))
+        {
+            return;
+        }
+        if (!run->input_parked.exchange(false, std::memory_order_seq_cst))
+        {
+            return; //A retiring token already re-pushed the input job
+        }
+    }
+
+    const PipelineStage& input {run->stages[0]};
+    void* item {input.fn(nullptr, input.user)};
+    if (!item)
+    {
+        return;
+    }
+
+    token->in_use.store(true, std::memory_order_relaxed);
+    token->item = item;
+    token->seq = run->next_input++;
+    token->stage = 1;
+
+    //Publish the next input before carrying this item on, so other workers can pick it up
+    pipeline_push(run, ctx, pipeline_input_job, run);
+    pipeline_advance(token, ctx);
+}
+
+//Runs `stages` over the items produced by stages[0] with at most `max_tokens` items in flight.
+//Completion is signalled through `counter` like any other job. Bookkeeping comes from ctx.arena.
+bool parallel_pipeline(JobContext& ctx, size_t max_tokens, const PipelineStage* stages, size_t stage_count, JobCounter* counter)
+{
+    if (max_tokens == 0 || stage_count == 0)
+    {
+        return false;
+    }
+
+    PipelineRun* run {arena_allocate<PipelineRun>(*ctx.arena)};
+    PipelineStageState* state {arena_allocate_array<PipelineStageState>(*ctx.arena, stage_count)};
+    PipelineToken* tokens {arena_allocate_array<PipelineToken>(*ctx.arena, max_tokens)};
+    std::atomic<size_t>* parked {arena_allocate_array<std::atomic<size_t>>(*ctx.arena, stage_count * max_tokens)};
+    if (!run || !state || !tokens || !parked)
+    {
+        return false;
+    }
+
+    run->stages = stages;
+    run->stage_count = stage_count;
+    run->state = state;
+    run->tokens = tokens;
+    run->parked = parked;
+    run->max_tokens = max_tokens;
+    run->next_input = 0;
+    run->input_parked.store(false, std::memory_order_relaxed);
+    run->counter = counter;
+    for (size_t i = 0; i < max_tokens; ++i)
+    {
+        tokens[i].run = run;
+    }
+
+    pipeline_push(run, &ctx, pipeline_input_job, run);
+    return true;
+}
+
+//---- Channels ----
+//Bounded lock-free queues of void* between jobs. Blocking send/recv don't spin: a job that can't make progress
+//parks its waiter and returns, and whoever changes the channel's state re-pushes parked waiters as jobs.
+//The continuation runs once the operation went through; for recv the value is in ChannelWaiter::value.
+enum class ChannelKind
+{
+    spsc, //One producing and one consuming job at a time, no CAS on the hot path
+    mpmc  //Any number of either (Vyukov bounded queue)
+};
+
+struct ChannelCell
+{
+    std::atomic<size_t> sequence; //mpmc only: tells producers and consumers whose turn the cell is
+    void* value;
+};
+
+struct Channel;
+
+struct ChannelWaiter //Caller-owned like TimerEntry, must stay valid until the continuation runs
+{
+    Channel* channel;
+    void* value;
+    Job continuation;
+    bool sending;
+    ChannelWaiter* next;
+    MailItem mail {}; //Woken waiters are posted, not pushed: one wake can release any number of them
+};
+
+struct Channel
+{
+    ChannelCell* cells;
+    size_t mask;
+    ChannelKind kind;
+
+    alignas(64) std::atomic<size_t> head; //Producers and consumers on separate lines
+    alignas(64) std::atomic<size_t> tail;
+
+    std::atomic<ChannelWaiter*> blocked_senders;
+    std::atomic<ChannelWaiter*> blocked_receivers;
+
+    Channel(const Channel&) = delete;
+    Channel& operator=(const Channel&) = delete;
+
+    //Capacity is rounded up to a power of two, and to at least 2 for mpmc: with a single cell a filled
+    //cell's sequence equals the next tail, so every send would look like it found a free cell.
+    //Cells come from the arena; running out is fatal like MAX_JOBS
+    Channel(Arena& arena, size_t capacity, ChannelKind kind)
+        : cells(nullptr),
+          mask(0),
+          kind(kind),
+          head(0),
+          tail(0),
+          blocked_senders(nullptr),
+          blocked_receivers(nullptr)
+    {
+        size_t size {kind == ChannelKind::mpmc ? size_t{2} : size_t{1}};
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+        cells = arena_allocate_array<ChannelCell>(arena, size);
+        if (!cells)
+        {
+            std::abort();
+        }
+        mask = size - 1;
+        for (size_t i = 0; i < size; ++i)
+        {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+};
+
+bool channel_try_send(Channel& ch, void* value)
+{
+    if (ch.kind == ChannelKind::spsc)
+    {
+        size_t t {ch.tail.load(std::memory_order_relaxed)};
+        if (t - ch.head.load(std::memory_order_acquire) > ch.mask)
+        {
+            return false;
+        }
+        ch.cells[t & ch.mask].value = value;
+        ch.tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t pos {ch.tail.load(std::memory_order_relaxed)};
+    while (true)
+    {
+        ChannelCell& cell {ch.cells[pos & ch.mask]};
+        size_t seq {cell.sequence.load(std::memory_order_acquire)};
+        auto diff {static_cast<std::ptrdiff_t>(seq - pos)};
+        if (diff == 0)
+        {
+            if (ch.tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                cell.value = value;
+                cell.sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0)
+        {
+            return false; //Cell still holds last lap's value: full
+        }
+        else
+        {
+            pos = ch.tail.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool channel_try_recv(Channel& ch, void*& out)
+{
+    if (ch.kind == ChannelKind::spsc)
+    {
+        size_t h {ch.head.load(std::memory_order_relaxed)};
+        if (h == ch.tail.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        out = ch.cells[h & ch.mask].value;
+        ch.head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t pos {ch.head.load(std::memory_order_relaxed)};
+    while (true)
+    {
+        ChannelCell& cell {ch.cells[pos & ch.mask]};
+        size_t seq {cell.sequence.load(std::memory_order_acquire)};
+        auto diff {static_cast<std::ptrdiff_t>(seq - (pos + 1))};
+        if (diff == 0)
+        {
+            if (ch.head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                out = cell.value;
+                cell.sequence.store(pos + ch.mask + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0)
+        {
+            return false; //Producer hasn't filled it yet: empty
+        }
+        else
+        {
+            pos = ch.head.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void channel_waiter_job(void* ptr, JobContext* ctx);
+
+//Takes the whole parked list at once (no ABA) and lets every waiter retry as a job. The retries are
+//posted round-robin to the workers' mailboxes, which only release what fits into each ring.
+void channel_wake_all(std::atomic<ChannelWaiter*>& blocked, JobContext& ctx)
+{
+    //Pairs with the fence in channel_attempt: the channel operation (a relaxed CAS plus release store
+    //for mpmc) must be ordered before this load, or both sides can miss each other and the waiter sleeps
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!blocked.load(std::memory_order_seq_cst))
+    {
+        return;
+    }
+    ChannelWaiter* waiter {blocked.exchange(nullptr, std::memory_order_acq_rel)};
+    size_t workers {ctx.workers ? std::max<size_t>(ctx.worker_count, 1) : 1};
+    size_t target {ctx.worker->id};
+    while (waiter)
+    {
+        ChannelWaiter* next {waiter->next};
+        JobCounter* counter {waiter->continuation.counter};
+        if (counter)
+        {
+            counter_add(*counter, &ctx, 1);
+        }
+        Worker& worker {ctx.workers ? ctx.workers[target] : *ctx.worker};
+        post_job(worker, &waiter->mail, Job{channel_waiter_job, waiter, counter, &ctx, true});
+        target = (target + 1) % workers;
+        waiter = next;
+    }
+}
+
+//One attempt at the waiter's operation. On failure the waiter parks, then re-checks the channel:
+//whoever changed it in between may have looked at the parked list before we were on it.
+void channel_attempt(ChannelWaiter* waiter, JobContext& ctx)
+{
+    Channel& ch {*waiter->channel};
+    bool sending {waiter->sending};
+    bool done {sending ? channel_try_send(ch, waiter->value) : channel_try_recv(ch, waiter->value)};
+    if (done)
+    {
+        push_job(*ctx.worker, waiter->continuation); //Already counted when the operation started
+        channel_wake_all(sending ? ch.blocked_receivers : ch.blocked_senders, ctx);
+        return;
+    }
+
+    std::atomic<ChannelWaiter*>& blocked {sending ? ch.blocked_senders : ch.blocked_receivers};
+    ChannelWaiter* head {blocked.load(std::memory_order_relaxed)};
+    do
+    {
+        waiter->next = head;
+    } while (!blocked.compare_exchange_weak(head, waiter, std::memory_order_seq_cst, std::memory_order_relaxed));
+
+    //The waiter may be running elsewhere already, only the channel is safe to look at now
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    size_t h {ch.head.load(std::memory_order_seq_cst)};
+    size_t t {ch.tail.load(std::memory_order_seq_cst)};
+    bool retry {sending ? t - h <= ch.mask : t != h};
+    if (retry)
+    {
+        channel_wake_all(blocked, ctx);
+    }
+}
+
+void channel_waiter_job(void* ptr, JobContext* ctx)
+{
+    channel_attempt(static_cast<ChannelWaiter*>(ptr), *ctx);
+}
+
+void channel_send(JobContext& ctx, Channel& ch, ChannelWaiter* waiter, void* value, Job continuation)
+{
+    *waiter = ChannelWaiter{&ch, value, continuation, true, nullptr};
+    if (continuation.is_leaf && continuation.counter)
+    {
+        counter_add(*continuation.counter, &ctx, 1);
+    }
+    channel_attempt(waiter, ctx);
+}
+
+void channel_recv(JobContext& ctx, Channel& ch, ChannelWaiter* waiter, Job continuation)
+{
+    *waiter = ChannelWaiter{&ch, nullptr, continuation, false, nullptr};
+    if (continuation.is_leaf && continuation.counter)
+    {
+        counter_add(*continuation.counter, &ctx, 1);
+    }
+    channel_attempt(waiter, ctx);
+}
+
+//One step of the scheduling loop: runs one job or moves released work into the local queue.
+//Returns false when nothing was found anywhere. Waiting primitives call this to help instead of blocking.
+bool run_one_job(
+    JobContext* ctx,
+    Worker* all_workers,
+    size_t worker_count
+)
+{
+    Worker* self {ctx->worker};
+    Job job;
+
+    //1. Trying local work
+    if(pop_local(self->queue,job))
+    {
+        size_t ran {1};
+        prefetch_next_job(self->queue);
+        job.fn(job.data, ctx);
+        Job next;
+        while(ran < JOB_BATCH_MAX && queue_top_matches(self->queue, job) && pop_local(self->queue, next))
+        {
+            prefetch_next_job(self->queue);
+            next.fn(next.data, ctx);
+            ++ran;
+        }
+        if(job.is_leaf && job.counter)
+        {
+            counter_retire(*job.counter, ctx, static_cast<int64_t>(ran));
+        }
+        return true;
+    }
+
+    //Work posted to us by other threads comes before anything we'd have to steal
+    if(poll_mailbox(*self) > 0)
+    {
+        return true;
+    }
+
+    //Releasing due timers refills the local queue before we go stealing
+    if(ctx->timers && poll_timers(*ctx->timers, *self) > 0)
+    {
+        return true;
+    }
+
+    //Same for I/O completions, their continuations run here instead of on a blocked worker
+    if(ctx->io && poll_io(*ctx->io, *self) > 0)
+    {
+        return true;
+    }
+
+    if(ctx->blocking && poll_blocking(*ctx->blocking, *self) > 0)
+    {
+        return true;
+    }
+    
+    //2.Trying to steal work from other Jobs
+    for(size_t i = 0; i < worker_count; ++i)
+    {
+        if(i == self->id)
+        {continue;}
+
+        if(steal(all_workers[i].queue, job, !self->efficiency))
+        {
+            execute_job(job, ctx);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool help_worker_groups(JobContext& ctx);
+bool job_system_should_park(JobContext& ctx);
+bool job_system_park(JobContext& ctx, JobCounter& counter);
+void job_system_step(JobContext& ctx, bool found);
+
+//Thread function
+void worker_thread(
+    JobContext* ctx,
+    Worker* all_workers,
+    size_t worker_count,
+    JobCounter* counter
+)
+{
+    size_t idle_sweeps {0};
+    while(true)
+    {
+        if(ctx->system && job_system_should_park(*ctx))
+        {
+            if(!job_system_park(*ctx, *counter))
+            {
+                break;
+            }
+            continue;
+        }
+
+        bool found {run_one_job(ctx, all_workers, worker_count)};
+        if(ctx->system)
+        {
+            job_system_step(*ctx, found);
+        }
+        if(found)
+        {
+            continue;
+        }
+
+        if(ctx->groups && help_worker_groups(*ctx))
+        {
+            continue;
+        }
+
+        //When no work is found anywhere
+        if(counter->done.load(std::memory_order_acquire))
+        {
+            break;
+        }
+
+        //Lazy zero check across all shards, only every few sweeps since it touches every busy worker's line
+        if((++idle_sweeps & (TERMINATION_SCAN_SWEEPS - 1)) == 0 && counter_is_zero(*counter))
+        {
+            counter->done.store(true, std::memory_order_release);
+            break;
+        }
+    }
+}
+
+//---- Latch & Barrier ----
+//Waiting jobs keep their worker busy with other jobs instead of blocking the OS thread, so a worker
+//waiting on a latch may well run the very jobs that will release it. ctx.workers must be set.
+void help_until_ready(JobContext& ctx, bool (*ready)(void*), void* state)
+{
+    while (!ready(state))
+    {
+        if (!run_one_job(&ctx, ctx.workers, ctx.worker_count))
+        {
+            std::this_thread::yield(); //Nothing to help with: let whoever we're waiting for run
+        }
+    }
+}
+
+struct Latch //Single use: opens once count_down has been called `count` times
+{
+    alignas(64) std::atomic<int64_t> remaining;
+
+    explicit Latch(int64_t count) : remaining(count) {}
+};
+
+void latch_count_down(Latch& latch, int64_t n = 1)
+{
+    latch.remaining.fetch_sub(n, std::memory_order_release);
+}
+
+bool latch_try_wait(Latch& latch)
+{
+    return latch.remaining.load(std::memory_order_acquire) <= 0;
+}
+
+void latch_wait(JobContext& ctx, Latch& latch)
+{
+    help_until_ready(ctx, [](void* l) { return latch_try_wait(*static_cast<Latch*>(l)); }, &latch);
+}
+
+//Helping would deadlock a barrier: a waiting participant could pick up another participant of the same
+//barrier on its own stack, and the outer one can't reach the next phase until the inner one returns.
+//So barrier participants suspend instead: each arrives with its next step as a continuation, and the
+//last arriver releases them all. A BSP superstep is simply "compute, then arrive with the next step".
+struct BarrierWaiter //Caller-owned like TimerEntry, reusable once its continuation has run
+{
+    Job continuation;
+    BarrierWaiter* next;
+    MailItem mail;
+};
+
+struct Barrier //Reusable: `participants` arrivals complete a phase, then the next phase starts
+{
+    alignas(64) std::atomic<size_t> arrived;
+    std::atomic<BarrierWaiter*> waiters;
+    std::atomic<size_t> phase;
+    size_t participants;
+    void (*on_phase)(void* user); //Run by the last arriver before anyone is released, e.g. a reduction step
+    void* user;
+
+    explicit Barrier(size_t participants, void (*on_phase)(void*) = nullptr, void* user = nullptr)
+        : arrived(0),
+          waiters(nullptr),
+          phase(0),
+          participants(participants),
+          on_phase(on_phase),
+          user(user)
+    {}
+};
+
+void barrier_arrive(JobContext& ctx, Barrier& barrier, BarrierWaiter* waiter, Job continuation)
+{
+    waiter->continuation = continuation;
+    if (continuation.is_leaf && continuation.counter)
+    {
+        counter_add(*continuation.counter, &ctx, 1);
+    }
+
+    BarrierWaiter* head {barrier.waiters.load(std::memory_order_relaxed)};
+    do
+    {
+        waiter->next = head;
+    } while (!barrier.waiters.compare_exchange_weak(head, waiter, std::memory_order_release, std::memory_order_relaxed));
+
+    //Everyone links in before counting, so the last arriver finds the complete list
+    if (barrier.arrived.fetch_add(1, std::memory_order_acq_rel) + 1 != barrier.participants)
+    {
+        return;
+    }
+
+    if (barrier.on_phase)
+    {
+        barrier.on_phase(barrier.user);
+    }
+    BarrierWaiter* released {barrier.waiters.exchange(nullptr, std::memory_order_acquire)};
+    barrier.arrived.store(0, std::memory_order_relaxed); //Nobody can arrive again before their continuation runs
+    barrier.phase.fetch_add(1, std::memory_order_release);
+
+    //Deal the next phase out over every worker's mailbox rather than flooding our own ring
+    size_t workers {ctx.workers ? std::max<size_t>(ctx.worker_count, 1) : 1};
+    size_t target {ctx.worker->id};
+    while (released)
+    {
+        BarrierWaiter* next {released->next};
+        Worker& worker {ctx.workers ? ctx.workers[target] : *ctx.worker};
+        post_job(worker, &released->mail, released->continuation);
+        target = (target + 1) % workers;
+        released = next;
+    }
+}
+
+//---- Worker groups ----
+//A group is a private set of per-worker rings that the pool's workers enter. Jobs spawned inside stay on
+//the group's rings, and anything waiting inside (latch_wait, job mutexes) only helps with the group's
+//jobs, so a library's parallelism never ends up running under our waits, or ours under its.
+//At most max_workers idle workers join a group at once. Group contexts carry no timers, I/O or blocking
+//pool: those release into the outer pool's rings.
+struct WorkerGroup //Outlives frames, so it is not arena-allocated
+{
+    std::vector<Worker> members; //One ring per pool worker, same ids as the pool
+    size_t max_workers;
+    alignas(64) std::atomic<size_t> active; //Workers currently inside
+    std::atomic<size_t> runs;                //worker_group_run calls in flight, idle workers only join while > 0
+    WorkerGroup* next;                       //Registry link
+
+    WorkerGroup(const JobContext& ctx, size_t max_workers)
+        : members(std::max<size_t>(ctx.worker_count, 1)),
+          max_workers(std::max<size_t>(max_workers, 1)),
+          active(0),
+          runs(0),
+          next(nullptr)
+    {
+        for (size_t i = 0; i < members.size(); ++i)
+        {
+            members[i].id = i;
+            members[i].queue.head.store(0);
+            members[i].queue.tail.store(0);
+            members[i].mailbox.store(nullptr);
+            members[i].mail_backlog = nullptr;
+        }
+    }
+};
+
+struct WorkerGroupRegistry //Shared by every context of a pool, see JobContext::groups
+{
+    std::atomic<WorkerGroup*> head;
+
+    WorkerGroupRegistry() : head(nullptr) {}
+};
+
+//Groups stay registered for the pool's lifetime
+void worker_group_register(WorkerGroupRegistry& registry, WorkerGroup& group)
+{
+    WorkerGroup* old_head {registry.head.load(std::memory_order_relaxed)};
+    do
+    {
+        group.next = old_head;
+    } while (!registry.head.compare_exchange_weak(old_head, &group, std::memory_order_release, std::memory_order_relaxed));
+}
+
+JobContext worker_group_context(const JobContext& outer, WorkerGroup& group)
+{
+    Worker* member {&group.members[outer.worker->id % group.members.size()]};
+    return JobContext{outer.arena, member, nullptr, nullptr, nullptr, group.members.size(), group.members.data(), nullptr};
+}
+
+//Runs root inside the group and returns once root.counter has drained, helping only with the group's jobs.
+//root.counter must be non-null and count nothing but this run. The caller is let in even over max_workers.
+void worker_group_run(JobContext& ctx, WorkerGroup& group, Job root)
+{
+    JobContext inner {worker_group_context(ctx, group)};
+    group.active.fetch_add(1, std::memory_order_relaxed);
+    group.runs.fetch_add(1, std::memory_order_release);
+
+    if (root.is_leaf)
+    {
+        counter_add(*root.counter, &inner, 1);
+    }
+    root.ctx = &inner;
+    push_job(*inner.worker, root);
+    help_until_ready(inner, [](void* c) { return counter_is_zero(*static_cast<JobCounter*>(c)); }, root.counter);
+
+    group.runs.fetch_sub(1, std::memory_order_relaxed);
+    group.active.fetch_sub(1, std::memory_order_relaxed);
+}
+
+//Called by idle workers: enters every group with runs in flight and room for another worker, and stays
+//until the group has nothing left for it. Mail posted to our ring in a group always lets us in,
+//since only we can drain it.
+bool help_worker_groups(JobContext& ctx)
+{
+    bool ran {false};
+    for (WorkerGroup* group = ctx.groups->head.load(std::memory_order_acquire); group; group = group->next)
+    {
+        if (group->runs.load(std::memory_order_acquire) == 0)
+        {
+            continue;
+        }
+        JobContext inner {worker_group_context(ctx, *group)};
+        bool has_mail {inner.worker->mailbox.load(std::memory_order_relaxed) != nullptr};
+        if (group->active.fetch_add(1, std::memory_order_acquire) >= group->max_workers && !has_mail)
+        {
+            group->active.fetch_sub(1, std::memory_order_relaxed);
+            continue;
+        }
+        while (run_one_job(&inner, inner.workers, inner.worker_count))
+        {
+            ran = true;
+        }
+        group->active.fetch_sub(1, std::memory_order_relaxed);
+    }
+    return ran;
+}
+
+//---- Job mutexes ----
+//On contention a job runs jobs from its own worker's queue instead of putting the thread to sleep,
+//so the worker and its deque keep moving. Only the local queue is used, which keeps the number of
+//unrelated jobs nested under the waiter small. Never wait on anything while holding one of these:
+//the job you help with may be the one that needs the lock, and you'd be under it on the stack.
+void help_local_once(JobContext& ctx)
+{
+    Job job;
+    if (pop_local(ctx.worker->queue, job))
+    {
+        execute_job(job, &ctx);
+    }
+    else
+    {
+        std::this_thread::yield();
+    }
+}
+
+struct JobMutex
+{
+    alignas(64) std::atomic<bool> locked;
+
+    JobMutex() : locked(false) {}
+};
+
+bool job_mutex_try_lock(JobMutex& m)
+{
+    //Test before test-and-set so waiters spin on a shared line instead of bouncing it
+    return !m.locked.load(std::memory_order_relaxed) && !m.locked.exchange(true, std::memory_order_acquire);
+}
+
+void job_mutex_lock(JobContext& ctx, JobMutex& m)
+{
+    while (!job_mutex_try_lock(m))
+    {
+        help_local_once(ctx);
+    }
+}
+
+void job_mutex_unlock(JobMutex& m)
+{
+    m.locked.store(false, std::memory_order_release);
+}
+
+//Writers are preferred only while they spin: a waiting writer stops new readers from entering for up to
+//JOB_SHARED_WRITER_SPINS yields, then drops its claim while it helps with a job. It can't hold readers off
+//while helping, since a reader job run under it on the same stack would wait for a writer that can't return
+//until that reader does. So writers are not starvation-free: readers that keep overlapping can hold a
+//writer off indefinitely. Use JobMutex where writers need progress under constant reads.
+struct JobSharedMutex
+{
+    static constexpr uint32_t WRITER {0x80000000u}; //Remaining bits count active readers
+
+    alignas(64) std::atomic<uint32_t> state;
+    std::atomic<uint32_t> writers_waiting;
+
+    JobSharedMutex() : state(0), writers_waiting(0) {}
+};
+
+bool job_shared_try_lock(JobSharedMutex& m)
+{
+    uint32_t expected {0};
+    return m.state.compare_exchange_strong(expected, JobSharedMutex::WRITER, std::memory_order_acquire, std::memory_order_relaxed);
+}
+
+constexpr size_t JOB_SHARED_WRITER_SPINS{64}; //Yields per round a waiting writer holds new readers off, see JobSharedMutex
+
+void job_shared_lock(JobContext& ctx, JobSharedMutex& m)
+{
+    while (true)
+    {
+        m.writers_waiting.fetch_add(1, std::memory_order_relaxed);
+        bool acquired {false};
+        for (size_t i = 0; i < JOB_SHARED_WRITER_SPINS && !acquired; ++i)
+        {
+            acquired = job_shared_try_lock(m);
+            if (!acquired)
+            {
+                std::this_thread::yield();
+            }
+        }
+        m.writers_waiting.fetch_sub(1, std::memory_order_relaxed);
+        if (acquired)
+        {
+            return;
+        }
+        help_local_once(ctx);
+    }
+}
+
+void job_shared_unlock(JobSharedMutex& m)
+{
+    m.state.fetch_and(~JobSharedMutex::WRITER, std::memory_order_release);
+}
+
+bool job_shared_try_lock_shared(JobSharedMutex& m)
+{
+    if (m.writers_waiting.load(std::memory_order_relaxed) != 0)
+    {
+        return false;
+    }
+    uint32_t current {m.state.load(std::memory_order_relaxed)};
+    while (!(current & JobSharedMutex::WRITER))
+    {
+        if (m.state.compare_exchange_weak(current, current + 1, std::memory_order_acquire, std::memory_order_relaxed))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void job_shared_lock_shared(JobContext& ctx, JobSharedMutex& m)
+{
+    while (!job_shared_try_lock_shared(m))
+    {
+        help_local_once(ctx);
+    }
+}
+
+void job_shared_unlock_shared(JobSharedMutex& m)
+{
+    m.state.fetch_sub(1, std::memory_order_release);
+}
+
+//---- CPU quota ----
+//Containers are usually limited by a CFS quota rather than by the CPUs they can see, and running more busy
+//workers than the quota allows only gets the whole process throttled. Returns the quota of our cgroup
+//rounded up to whole cores, or 0 when there is none or it can't be read.
+#if defined(__linux__)
+size_t cgroup_quota_cores(double quota, double period)
+{
+    if (quota <= 0 || period <= 0)
+    {
+        return 0;
+    }
+    return std::max<size_t>(static_cast<size_t>(std::ceil(quota / period)), 1);
+}
+
+size_t cgroup_cpu_limit()
+{
+    //cgroup v2: cpu.max of our own cgroup holds "<quota> <period>", or "max <period>" when unlimited
+    std::string own {"/sys/fs/cgroup"};
+    std::ifstream membership {"/proc/self/cgroup"};
+    std::string line;
+    while (std::getline(membership, line))
+    {
+        if (line.rfind("0::", 0) == 0)
+        {
+            own += line.substr(3);
+            break;
+        }
+    }
+    for (const std::string& dir : {own, std::string{"/sys/fs/cgroup"}})
+    {
+        std::ifstream cpu_max {dir + "/cpu.max"};
+        std::string quota;
+        double period {0};
+        if (cpu_max >> quota >> period)
+        {
+            return quota == "max" ? 0 : cgroup_quota_cores(std::atof(quota.c_str()), period);
+        }
+    }
+
+    //cgroup v1: cfs_quota_us is -1 when unlimited
+    for (const std::string dir : {"/sys/fs/cgroup/cpu", "/sys/fs/cgroup/cpu,cpuacct"})
+    {
+        std::ifstream quota_file {dir + "/cpu.cfs_quota_us"};
+        std::ifstream period_file {dir + "/cpu.cfs_period_us"};
+        double quota {0};
+        double period {0};
+        if (quota_file >> quota && period_file >> period)
+        {
+            return cgroup_quota_cores(quota, period);
+        }
+    }
+    return 0;
+}
+#else
+size_t cgroup_cpu_limit()
+{
+    return 0;
+}
+#endif
+
+//CPUs this process may actually run on: the affinity mask (cpuset, taskset) rather than every CPU in the host
+size_t available_cpus()
+{
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0)
+    {
+        return static_cast<size_t>(CPU_COUNT(&set));
+    }
+#endif
+    unsigned int hint {std::thread::hardware_concurrency()};
+    return hint > 0 ? hint : 1;
+}
+
+//Default pool size: JOB_SYSTEM_WORKERS when set, otherwise one less than the CPUs we may run on (affinity
+//mask, then cgroup quota) so the rest of the process keeps a core.
+size_t default_worker_count()
+{
+    if (const char* override_count = std::getenv("JOB_SYSTEM_WORKERS"))
+    {
+        long requested {std::strtol(override_count, nullptr, 10)};
+        if (requested > 0)
+        {
+            return static_cast<size_t>(requested);
+        }
+    }
+    size_t cpus {available_cpus()};
+    size_t quota {cgroup_cpu_limit()};
+    if (quota > 0)
+    {
+        cpus = std::min(cpus, quota);
+    }
+    return cpus > 1 ? cpus - 1 : 1;
+}
+
+//---- Hybrid cores ----
+//On hybrid CPUs (P/E cores, big.LITTLE) identical workers run at very different speeds. detect_cpus reads
+//each allowed CPU's capacity from sysfs: cpu_capacity where the kernel exposes it, otherwise the ratio of
+//max frequencies. Intel's cpu_atom PMU list marks efficiency cores outright.
+constexpr uint32_t CPU_EFFICIENCY_CAPACITY{768}; //Below this a core counts as an efficiency core
+
+struct CpuInfo
+{
+    int cpu;
+    uint32_t capacity; //Relative to the fastest allowed CPU, which gets CPU_CAPACITY_SCALE
+    bool efficiency;
+};
+
+#if defined(__linux__)
+//Parses a sysfs cpu list such as "0-7,16-23"
+std::vector<int> parse_cpu_list(const std::string& list)
+{
+    std::vector<int> cpus;
+    size_t pos {0};
+    while (pos < list.size())
+    {
+        size_t comma {list.find(',', pos)};
+        std::string item {list.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos)};
+        size_t dash {item.find('-')};
+        int first {std::atoi(item.c_str())};
+        int last {dash == std::string::npos ? first : std::atoi(item.c_str() + dash + 1)};
+        for (int cpu = first; cpu <= last; ++cpu)
+        {
+            cpus.push_back(cpu);
+        }
+        if (comma == std::string::npos)
+        {
+            break;
+        }
+        pos = comma + 1;
+    }
+    return cpus;
+}
+
+uint64_t read_sysfs_u64(const std::string& path)
+{
+    std::ifstream file {path};
+    uint64_t value {0};
+    file >> value;
+    return value;
+}
+#endif
+
+//Allowed CPUs, fastest first. Empty where the topology can't be read.
+std::vector<CpuInfo> detect_cpus()
+{
+    std::vector<CpuInfo> cpus;
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) != 0)
+    {
+        return cpus;
+    }
+
+    std::vector<int> atoms;
+    std::ifstream atom_file {"/sys/devices/cpu_atom/cpus"};
+    std::string atom_list;
+    if (std::getline(atom_file, atom_list))
+    {
+        atoms = parse_cpu_list(atom_list);
+    }
+
+    std::vector<uint64_t> raw;
+    uint64_t fastest {0};
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+        if (!CPU_ISSET(cpu, &set))
+        {
+            continue;
+        }
+        std::string dir {"/sys/devices/system/cpu/cpu" + std::to_string(cpu)};
+        uint64_t capacity {read_sysfs_u64(dir + "/cpu_capacity")};
+        if (capacity == 0)
+        {
+            capacity = read_sysfs_u64(dir + "/cpufreq/cpuinfo_max_freq");
+        }
+        bool atom {std::find(atoms.begin(), atoms.end(), cpu) != atoms.end()};
+        cpus.push_back(CpuInfo{cpu, 0, atom});
+        raw.push_back(capacity);
+        fastest = std::max(fastest, capacity);
+    }
+
+    for (size_t i = 0; i < cpus.size(); ++i)
+    {
+        cpus[i].capacity = fastest ? static_cast<uint32_t>(std::max<uint64_t>(raw[i] * CPU_CAPACITY_SCALE / fastest, 1)) : CPU_CAPACITY_SCALE;
+        cpus[i].efficiency = cpus[i].efficiency || cpus[i].capacity < CPU_EFFICIENCY_CAPACITY;
+    }
+    std::stable_sort(cpus.begin(), cpus.end(), [](const CpuInfo& a, const CpuInfo& b) { return a.capacity > b.capacity; });
+#endif
+    return cpus;
+}
+
+bool pin_current_thread(int cpu)
+{
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
+
+//---- Job systems & core budget ----
+//A JobSystem owns one pool: its workers, their arenas and contexts, and the timers, I/O ring and blocking
+//pool its jobs release into. Systems in one process can share a CoreBudget: each running system is
+//allowed a share of the budget's cores and its workers above that share park, so the systems together
+//never run more workers than the budget has cores. Worker 0 is the thread calling job_system_run and
+//never parks. Shares are rebalanced whenever a system starts or finishes a run, or its elastic target moves.
+//
+//Elastic systems also size themselves by load: every ELASTIC_SAMPLE_PERIOD one worker samples queue depth
+//and how many running workers found nothing at all, and the target worker count grows on sustained
+//backlog and shrinks on sustained starvation. The target never exceeds the cgroup CPU quota.
+constexpr std::chrono::milliseconds WORKER_PARK_POLL{1}; //Parked workers wake this often to forward mail and check for the end of the run
+constexpr std::chrono::microseconds ELASTIC_SAMPLE_PERIOD{1000};
+constexpr size_t ELASTIC_GROW_DEPTH{4};      //Queued jobs per running worker that count as a backlog
+constexpr size_t ELASTIC_SUSTAIN_SAMPLES{4}; //Consecutive samples a signal must hold before the worker count moves
+constexpr size_t ELASTIC_TICK_STEPS{64};     //Scheduler steps between sample clock checks, power of two
+
+struct alignas(64) WorkerLoad //Written only by its own worker
+{
+    std::atomic<uint64_t> found;  //Scheduler steps that ran or released work
+    std::atomic<uint64_t> missed; //Steps that found nothing, failed steals included
+};
+
+struct JobSystem;
+
+struct CoreBudget
+{
+    std::mutex mutex;
+    size_t cores;
+    std::vector<JobSystem*> systems; //Guarded by mutex
+
+    explicit CoreBudget(size_t cores) : cores(std::max<size_t>(cores, 1)) {}
+};
+
+struct JobSystem
+{
+    std::vector<Worker> workers;
+    std::deque<Arena> arenas; //One per worker so jobs never share an arena, arenas[0] is the caller's frame arena
+    TimerWheel timers;
+    IoRing io;
+    BlockingPool blocking;
+    WorkerGroupRegistry groups;
+    std::vector<JobContext> contexts;
+    std::vector<int> placement; //CPU each worker is pinned to during a run, empty = unpinned
+
+    CoreBudget* budget;
+    size_t wanted;                           //Guarded by budget->mutex: workers asked for while running, 0 otherwise
+    size_t cpu_limit;                        //cgroup quota in cores, 0 = none
+    bool elastic;
+    alignas(64) std::atomic<size_t> allowed; //min(share, target): workers with id >= allowed park
+    std::atomic<size_t> share;               //Granted by the budget, or the whole pool without one
+    std::atomic<size_t> target;              //Workers the load calls for
+    std::mutex park_mutex;
+    std::condition_variable unpark;
+
+    std::vector<WorkerLoad> loads;
+    std::atomic<int64_t> next_sample; //steady_clock nanoseconds
+    std::atomic<bool> sampling;
+    std::vector<uint64_t> last_found;  //Sampler-only, like the streaks
+    std::vector<uint64_t> last_missed;
+    size_t grow_streak;
+    size_t shrink_streak;
+
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    JobSystem(size_t worker_count, size_t arena_bytes, CoreBudget* budget = nullptr, bool elastic = false)
+        : workers(std::max<size_t>(worker_count, 1)),
+          contexts(workers.size()),
+          budget(budget),
+          wanted(0),
+          cpu_limit(cgroup_cpu_limit()),
+          elastic(elastic),
+          allowed(workers.size()),
+          share(workers.size()),
+          target(workers.size()),
+          loads(workers.size()),
+          next_sample(0),
+          sampling(false),
+          last_found(workers.size(), 0),
+          last_missed(workers.size(), 0),
+          grow_streak(0),
+          shrink_streak(0)
+    {
+        for (size_t i = 0; i < workers.size(); ++i)
+        {
+            workers[i].id = i;
+            workers[i].queue.head.store(0);
+            workers[i].queue.tail.store(0);
+            workers[i].mailbox.store(nullptr);
+            workers[i].mail_backlog = nullptr;
+            arenas.emplace_back(arena_bytes);
+        }
+        for (size_t i = 0; i < workers.size(); ++i)
+        {
+            contexts[i] = JobContext{&arenas[i], &workers[i], &timers, &io, &blocking, workers.size(), workers.data(), &groups, this};
+        }
+        if (budget)
+        {
+            std::lock_guard<std::mutex> lock(budget->mutex);
+            budget->systems.push_back(this);
+        }
+    }
+
+    ~JobSystem()
+    {
+        if (budget)
+        {
+            std::lock_guard<std::mutex> lock(budget->mutex);
+            budget->systems.erase(std::find(budget->systems.begin(), budget->systems.end(), this));
+        }
+    }
+};
+
+size_t job_system_cap(const JobSystem& system)
+{
+    size_t size {system.workers.size()};
+    return system.cpu_limit ? std::min(size, system.cpu_limit) : size;
+}
+
+void job_system_apply(JobSystem& system)
+{
+    size_t share {system.share.load(std::memory_order_relaxed)};
+    size_t target {system.target.load(std::memory_order_relaxed)};
+    system.allowed.store(std::max<size_t>(std::min(share, target), 1), std::memory_order_relaxed);
+    std::lock_guard<std::mutex> park_lock(system.park_mutex);
+    system.unpark.notify_all();
+}
+
+//Max-min fair split: every running system keeps its calling thread, the remaining cores are dealt out
+//one at a time to systems that still want more.
+void core_budget_rebalance(CoreBudget& budget)
+{
+    std::lock_guard<std::mutex> lock(budget.mutex);
+    std::vector<size_t> shares(budget.systems.size(), 0);
+    size_t left {budget.cores};
+    for (size_t i = 0; i < shares.size(); ++i)
+    {
+        if (budget.systems[i]->wanted > 0)
+        {
+            shares[i] = 1;
+            left = left > 0 ? left - 1 : 0;
+        }
+    }
+    bool granted {true};
+    while (left > 0 && granted)
+    {
+        granted = false;
+        for (size_t i = 0; i < shares.size() && left > 0; ++i)
+        {
+            if (shares[i] < budget.systems[i]->wanted)
+            {
+                ++shares[i];
+                --left;
+                granted = true;
+            }
+        }
+    }
+    for (size_t i = 0; i < shares.size(); ++i)
+    {
+        JobSystem& system {*budget.systems[i]};
+        system.share.store(std::max<size_t>(shares[i], 1), std::memory_order_relaxed);
+        job_system_apply(system);
+    }
+}
+
+void job_system_request(JobSystem& system, size_t workers)
+{
+    if (!system.budget)
+    {
+        system.share.store(std::min(std::max<size_t>(workers, 1), system.workers.size()), std::memory_order_relaxed);
+        job_system_apply(system);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(system.budget->mutex);
+        system.wanted = std::min(workers, system.workers.size());
+    }
+    core_budget_rebalance(*system.budget);
+}
+
+//Moves self's mailbox and backlog round-robin onto targets[0, allowed)
+void forward_worker_mail(Worker& self, Worker* targets, size_t allowed)
+{
+    size_t target {self.id};
+    MailItem* item {self.mailbox.exchange(nullptr, std::memory_order_acquire)};
+    while (item || self.mail_backlog)
+    {
+        if (!item)
+        {
+            item = self.mail_backlog;
+            self.mail_backlog = nullptr;
+        }
+        MailItem* next {item->next};
+        post_job(targets[target++ % allowed], item, item->job);
+        item = next;
+    }
+}
+
+//A parked worker hands mail posted to it to the workers still running, only it could drain it.
+//That includes its rings in worker groups, which parallel_for_static inside a group posts to.
+void forward_mail(JobContext& ctx)
+{
+    size_t allowed {std::max<size_t>(ctx.system->allowed.load(std::memory_order_relaxed), 1)};
+    forward_worker_mail(*ctx.worker, ctx.workers, allowed);
+    for (WorkerGroup* group = ctx.groups->head.load(std::memory_order_acquire); group; group = group->next)
+    {
+        Worker& member {group->members[ctx.worker->id % group->members.size()]};
+        forward_worker_mail(member, group->members.data(), std::min(allowed, group->members.size()));
+    }
+}
+
+bool job_system_should_park(JobContext& ctx)
+{
+    return ctx.worker->id >= ctx.system->allowed.load(std::memory_order_relaxed);
+}
+
+//Compares this period's per-worker steps against the last sample. A running worker that found nothing
+//at all is starving; one spare searcher is fine, more than that means the pool is too big for the load.
+void elastic_sample(JobSystem& system)
+{
+    size_t active {system.allowed.load(std::memory_order_relaxed)};
+    size_t depth {0};
+    size_t starved {0};
+    for (size_t i = 0; i < system.workers.size(); ++i)
+    {
+        uint64_t found {system.loads[i].found.load(std::memory_order_relaxed)};
+        uint64_t missed {system.loads[i].missed.load(std::memory_order_relaxed)};
+        bool idle {found == system.last_found[i] && missed != system.last_missed[i]};
+        system.last_found[i] = found;
+        system.last_missed[i] = missed;
+        if (i >= active)
+        {
+            continue;
+        }
+        JobQueue& q {system.workers[i].queue};
+        std::ptrdiff_t queued {static_cast<std::ptrdiff_t>(q.tail.load(std::memory_order_relaxed) - q.head.load(std::memory_order_relaxed))};
+        depth += queued > 0 ? static_cast<size_t>(queued) : 0;
+        starved += idle ? 1 : 0;
+    }
+
+    if (starved == 0 && depth >= active * ELASTIC_GROW_DEPTH)
+    {
+        ++system.grow_streak;
+        system.shrink_streak = 0;
+    }
+    else if (starved > 1)
+    {
+        ++system.shrink_streak;
+        system.grow_streak = 0;
+    }
+    else
+    {
+        system.grow_streak = 0;
+        system.shrink_streak = 0;
+    }
+
+    size_t target {system.target.load(std::memory_order_relaxed)};
+    size_t next {target};
+    if (system.grow_streak >= ELASTIC_SUSTAIN_SAMPLES)
+    {
+        system.grow_streak = 0;
+        next = std::min(target + 1, job_system_cap(system));
+    }
+    if (system.shrink_streak >= ELASTIC_SUSTAIN_SAMPLES)
+    {
+        system.shrink_streak = 0;
+        next = target > 1 ? target - 1 : 1;
+    }
+    if (next != target)
+    {
+        system.target.store(next, std::memory_order_relaxed);
+        job_system_request(system, next); //Cores we stop wanting go back to the budget
+    }
+}
+
+int64_t steady_now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//Called by worker_thread after every scheduling step
+void job_system_step(JobContext& ctx, bool found)
+{
+    JobSystem& system {*ctx.system};
+    WorkerLoad& load {system.loads[ctx.worker->id]};
+    std::atomic<uint64_t>& tally {found ? load.found : load.missed};
+    tally.store(tally.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+    if (!system.elastic || ((load.found.load(std::memory_order_relaxed) + load.missed.load(std::memory_order_relaxed)) & (ELASTIC_TICK_STEPS - 1)) != 0)
+    {
+        return;
+    }
+    int64_t now {steady_now_ns()};
+    if (now < system.next_sample.load(std::memory_order_relaxed) || system.sampling.exchange(true, std::memory_order_acquire))
+    {
+        return;
+    }
+    system.next_sample.store(now + std::chrono::duration_cast<std::chrono::nanoseconds>(ELASTIC_SAMPLE_PERIOD).count(), std::memory_order_relaxed);
+    elastic_sample(system);
+    system.sampling.store(false, std::memory_order_release);
+}
+
+//Returns false if the run finished while we were parked
+bool job_system_park(JobContext& ctx, JobCounter& counter)
+{
+    JobSystem& system {*ctx.system};
+    std::unique_lock<std::mutex> lock(system.park_mutex);
+    while (ctx.worker->id >= system.allowed.load(std::memory_order_relaxed))
+    {
+        if (counter.done.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        lock.unlock();
+        forward_mail(ctx);
+        lock.lock();
+        system.unpark.wait_for(lock, WORKER_PARK_POLL);
+    }
+    return true;
+}
+
+//Pins worker i to cpus[i % n] for the following runs. Pass detect_cpus(): it lists the fastest cores first,
+//so low worker ids (and the shares granted first) land on performance cores. Also records each
+//worker's capacity for parallel_for_static and the steal preference of latency-critical jobs.
+void job_system_place_workers(JobSystem& system, const std::vector<CpuInfo>& cpus)
+{
+    system.placement.clear();
+    if (cpus.empty())
+    {
+        return;
+    }
+    for (size_t i = 0; i < system.workers.size(); ++i)
+    {
+        const CpuInfo& cpu {cpus[i % cpus.size()]};
+        system.placement.push_back(cpu.cpu);
+        system.workers[i].capacity = cpu.capacity;
+        system.workers[i].efficiency = cpu.efficiency;
+    }
+}
+
+//Runs the pool until counter drains: worker 0 on the calling thread, the rest on threads of their own.
+//Jobs must have been pushed (and counted) before the call.
+void job_system_run(JobSystem& system, JobCounter& counter)
+{
+    size_t worker_count {system.workers.size()};
+    size_t cap {job_system_cap(system)};
+    for (size_t i = 0; i < worker_count; ++i)
+    {
+        system.last_found[i] = system.loads[i].found.load(std::memory_order_relaxed);
+        system.last_missed[i] = system.loads[i].missed.load(std::memory_order_relaxed);
+    }
+    system.grow_streak = 0;
+    system.shrink_streak = 0;
+    system.next_sample.store(0, std::memory_order_relaxed);
+    system.target.store(cap, std::memory_order_relaxed);
+    job_system_request(system, cap);
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < worker_count; ++i)
+    {
+        threads.emplace_back([&system, &counter, i, worker_count] {
+            if (!system.placement.empty())
+            {
+                pin_current_thread(system.placement[i]);
+            }
+            worker_thread(&system.contexts[i], system.workers.data(), worker_count, &counter);
+        });
+    }
+
+#if defined(__linux__)
+    //The caller runs worker 0, so it is pinned for the run and gets its own mask back afterwards
+    cpu_set_t caller_mask;
+    bool restore_caller {!system.placement.empty() && sched_getaffinity(0, sizeof(caller_mask), &caller_mask) == 0};
+    if (restore_caller)
+    {
+        pin_current_thread(system.placement[0]);
+    }
+#endif
+    worker_thread(&system.contexts[0], system.workers.data(), worker_count, &counter);
+#if defined(__linux__)
+    if (restore_caller)
+    {
+        sched_setaffinity(0, sizeof(caller_mask), &caller_mask);
+    }
+#endif
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+
+    job_system_request(system, 0);
+}
+
+void push_job(Worker& w, Job job)
+{
+    size_t t {w.queue.tail.load(std::memory_order_relaxed)};
+    size_t h {w.queue.head.load(std::memory_order_acquire)};
+    if(t - h >= MAX_JOBS)
+    {
+        std::abort(); //See MAX_JOBS: overflowing the ring would overwrite jobs that haven't run yet
+    }
+    queue_write(w.queue, t, job);
+    w.queue.tail.store(t+1, std::memory_order_release); //Thieves must see the job before the new tail
+}
+
+//Build with -DJOB_SYSTEM_NO_MAIN to include this file from a test or another program
+#if !defined(JOB_SYSTEM_NO_MAIN)
+int main()
+{
+    const size_t worker_count {default_worker_count()};//Affinity mask and cgroup quota, not the host's CPU count
+    JobSystem system(worker_count, 1024);
+    JobCounter counter;  // ✅ every shard starts at 0
+
+    Arena& frameArena {system.arenas[0]};
+    JobContext& mainContext {system.contexts[0]};
+
+    int a[] = {1,2,3};
+    int b[] = {4,5,6};
+    std::atomic<int> out1{0};
+    std::atomic<int> out2{0};
+
+    auto* p1 = arena_allocate<SumRangeJobData>(frameArena, a, 0 , 3, &out1, &mainContext, &counter);
+    auto* p2 = arena_allocate<SumRangeJobData>(frameArena, b, 0 , 3, &out2, &mainContext, &counter);
+
+    // Initial jobs = future work → increment counter
+    counter_add(counter, nullptr, 2);
+
+    // Pushing the initial jobs
+    push_job(system.workers[0], Job{sum_job, p1, &counter, &mainContext, true});
+    push_job(system.workers[0], Job{sum_job, p2, &counter, &mainContext, true});
+
+    // Delayed job: released by the timer wheel ~5ms from now instead of sleeping a thread
+    std::atomic<int> out3{0};
+    auto* p3 = arena_allocate<SumRangeJobData>(frameArena, a, 0 , 3, &out3, &mainContext, &counter);
+    auto* t3 = arena_allocate<TimerEntry>(frameArena);
+    schedule_after(system.timers, t3, std::chrono::milliseconds{5}, Job{sum_job, p3, &counter, &mainContext, true});
+
+    //Main thread works as worker 0, the others get their own threads until the counter drains
+    job_system_run(system, counter);
+
+    // ✅ completion check
+    if (counter_is_zero(counter))
+    {
+        for(auto& arena : system.arenas)
+        {
+            arena.reset();
+        }
+    }
+}
+#endif
@@ -0,0 +1,97 @@
+//Channel regression test. Build from the repo root:
+//g++ -std=c++17 -O2 -pthread tests/channel_test.cpp -o channel_test && ./channel_test
+#define JOB_SYSTEM_NO_MAIN
+#include "../src/Arena_Allocator.cpp"
+
+#include <cstdio>
+
+static int failures {0};
+
+static void check(bool ok, const char* what)
+{
+    if (!ok)
+    {
+        std::printf("FAIL: %s\n", what);
+        ++failures;
+    }
+}
+
+//A capacity-1 mpmc channel used to accept every send, overwriting the one value it holds
+static void capacity_one_try_ops()
+{
+    Arena arena(1 << 12);
+    Channel ch(arena, 1, ChannelKind::mpmc);
+    int a {1};
+    int b {2};
+    void* out {nullptr};
+
+    check(channel_try_send(ch, &a), "first send fits");
+    check(channel_try_send(ch, &b), "second send fits once rounded up to 2 cells");
+    check(!channel_try_send(ch, &b), "third send reports full");
+    check(channel_try_recv(ch, out) && out == &a, "first recv returns first value");
+    check(channel_try_recv(ch, out) && out == &b, "second recv returns second value");
+    check(!channel_try_recv(ch, out), "recv on drained channel reports empty");
+}
+
+constexpr size_t CHANNEL_TEST_ITEMS {100};
+
+static Channel* test_channel {nullptr};
+static JobCounter* test_counter {nullptr};
+static ChannelWaiter send_waiters[CHANNEL_TEST_ITEMS];
+static ChannelWaiter recv_waiters[CHANNEL_TEST_ITEMS];
+static MailItem recv_mail[CHANNEL_TEST_ITEMS];
+static std::atomic<size_t> sent {0};
+static std::atomic<size_t> received_sum {0};
+
+static void on_sent(void*, JobContext*)
+{
+    sent.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void on_received(void* ptr, JobContext*)
+{
+    auto* waiter {static_cast<ChannelWaiter*>(ptr)};
+    received_sum.fetch_add(reinterpret_cast<size_t>(waiter->value), std::memory_order_relaxed);
+}
+
+static void receive_one(void* ptr, JobContext* ctx)
+{
+    auto i {reinterpret_cast<size_t>(ptr)};
+    channel_recv(*ctx, *test_channel, &recv_waiters[i], Job{on_received, &recv_waiters[i], test_counter, ctx, true});
+}
+
+//Senders park on a full capacity-1 channel, then receivers on every worker drain it
+static void capacity_one_parked_senders()
+{
+    JobSystem system(4, 1 << 20);
+    JobCounter counter;
+    Channel ch(system.arenas[0], 1, ChannelKind::mpmc);
+    test_channel = &ch;
+    test_counter = &counter;
+    JobContext& ctx {system.contexts[0]};
+
+    for (size_t i = 0; i < CHANNEL_TEST_ITEMS; ++i)
+    {
+        channel_send(ctx, ch, &send_waiters[i], reinterpret_cast<void*>(i + 1), Job{on_sent, nullptr, &counter, &ctx, true});
+    }
+    for (size_t i = 0; i < CHANNEL_TEST_ITEMS; ++i)
+    {
+        counter_add(counter, nullptr, 1);
+        post_job(system.workers[i % system.workers.size()], &recv_mail[i], Job{receive_one, reinterpret_cast<void*>(i), &counter, &ctx, true});
+    }
+    job_system_run(system, counter);
+
+    check(sent.load() == CHANNEL_TEST_ITEMS, "every parked sender completes");
+    check(received_sum.load() == CHANNEL_TEST_ITEMS * (CHANNEL_TEST_ITEMS + 1) / 2, "every value is received exactly once");
+}
+
+int main()
+{
+    capacity_one_try_ops();
+    capacity_one_parked_senders();
+    if (failures == 0)
+    {
+        std::printf("channel_test: ok\n");
+    }
+    return failures == 0 ? 0 : 1;
+}
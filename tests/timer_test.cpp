@@ -0,0 +1,83 @@
+//Timer wheel regression test. Build from the repo root:
+//g++ -std=c++17 -O2 -pthread tests/timer_test.cpp -o timer_test && ./timer_test
+#define JOB_SYSTEM_NO_MAIN
+#include "../src/Arena_Allocator.cpp"
+
+#include <cstdio>
+
+static int failures {0};
+
+static void check(bool ok, const char* what)
+{
+    if (!ok)
+    {
+        std::printf("FAIL: %s\n", what);
+        ++failures;
+    }
+}
+
+struct TimerProbe
+{
+    std::chrono::steady_clock::time_point scheduled;
+    std::chrono::microseconds delay;
+    std::chrono::steady_clock::duration elapsed;
+};
+
+static void record_fire(void* ptr, JobContext*)
+{
+    auto* probe {static_cast<TimerProbe*>(ptr)};
+    probe->elapsed = std::chrono::steady_clock::now() - probe->scheduled;
+}
+
+//Delays that aren't whole ticks, and timers scheduled partway through a tick, used to fire up to a tick early
+static void never_fires_early(std::chrono::microseconds tick)
+{
+    constexpr size_t count {8};
+    const std::chrono::microseconds delays[count] {
+        std::chrono::microseconds{0},    std::chrono::microseconds{300},  std::chrono::microseconds{1000},
+        std::chrono::microseconds{1500}, std::chrono::microseconds{2300}, std::chrono::microseconds{5000},
+        std::chrono::microseconds{7100}, std::chrono::microseconds{12000}};
+
+    Worker worker;
+    worker.id = 0;
+    worker.queue.head.store(0);
+    worker.queue.tail.store(0);
+    worker.mailbox.store(nullptr);
+    worker.mail_backlog = nullptr;
+    TimerWheel wheel(tick);
+    JobCounter counter;
+    TimerEntry entries[count];
+    TimerProbe probes[count];
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        //Stagger the starts so they land at different offsets within a tick
+        std::this_thread::sleep_for(std::chrono::microseconds{170});
+        probes[i] = TimerProbe{std::chrono::steady_clock::now(), delays[i], {}};
+        schedule_after(wheel, &entries[i], delays[i], Job{record_fire, &probes[i], &counter, nullptr, true});
+    }
+    JobContext ctx {nullptr, &worker, &wheel, nullptr, nullptr, 1, &worker};
+    worker_thread(&ctx, &worker, 1, &counter);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (probes[i].elapsed < probes[i].delay)
+        {
+            std::printf("tick %lldus: %lldus timer fired after %lldus\n", static_cast<long long>(tick.count()),
+                        static_cast<long long>(probes[i].delay.count()),
+                        static_cast<long long>(std::chrono::duration_cast<std::chrono::microseconds>(probes[i].elapsed).count()));
+        }
+        check(probes[i].elapsed >= probes[i].delay, "timer fires no earlier than its delay");
+    }
+}
+
+int main()
+{
+    never_fires_early(std::chrono::milliseconds{1});
+    never_fires_early(std::chrono::microseconds{700});
+    if (failures == 0)
+    {
+        std::printf("timer_test: ok\n");
+    }
+    return failures == 0 ? 0 : 1;
+}